@@ -1,5 +1,24 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 
 enum class TraversalType {
@@ -8,18 +27,406 @@ enum class TraversalType {
   PostOrder
 };
 
-template <typename Key, typename Compare = std::less<Key>, typename Allocator = std::allocator<Key>>
+// Keys compared through Compare as they are; see prefix_less below for the opt-in string cache.
+template <typename Key, typename Compare>
+struct key_prefix_cache {
+  static constexpr bool enabled = false;
+
+  struct type {};
+
+  struct search {
+	explicit search(const Key&) {}
+  };
+};
+
+// For std::string keys ordered by prefix_less every node caches the length of the prefix it shares
+// with its parent's key and the 8 bytes that follow. A search remembers how much of the probe matched
+// the previous node, so most steps are decided from those numbers or the cached bytes without
+// touching the key's heap buffer; a real comparison resumes where the shared prefix ends. Short keys
+// already live inline in the node thanks to the small string optimization.
+struct string_prefix_cache {
+  static constexpr bool enabled = true;
+
+  struct type {
+	std::uint64_t bytes;
+	std::size_t offset;
+  };
+
+  static std::uint64_t load(const std::string& key, std::size_t offset) {
+	std::uint64_t bytes = 0;
+	for (std::size_t i = 0; i < 8; ++i) {
+	  bytes <<= 8;
+	  if (offset + i < key.size()) {
+		bytes |= static_cast<unsigned char>(key[offset + i]);
+	  }
+	}
+	return bytes;
+  }
+
+  static std::size_t common_prefix(const std::string& lhs, const std::string& rhs, std::size_t from) {
+	std::size_t length = std::min(lhs.size(), rhs.size());
+	while (from < length && lhs[from] == rhs[from]) {
+	  ++from;
+	}
+	return from;
+  }
+
+  static type make(const std::string& key, const std::string* parent) {
+	std::size_t offset = parent ? common_prefix(key, *parent, 0) : 0;
+	return {load(key, offset), offset};
+  }
+
+  class search {
+   public:
+	explicit search(const std::string& key)
+		: key_(key)
+		, matched_(std::string::npos)
+		, order_(0)
+	{}
+
+	// Three-way order of the probe against node_key. Must see the nodes of one downward path in
+	// order, since the cache of each node is relative to its parent; the first node, which may be
+	// anywhere in the tree, is compared in full.
+	int operator()(const std::string& node_key, const type& cache) {
+	  if (matched_ == std::string::npos) {
+		matched_ = common_prefix(key_, node_key, 0);
+		return finish(node_key);
+	  }
+	  if (matched_ < cache.offset) {
+		return order_;
+	  }
+	  if (matched_ > cache.offset) {
+		// The probe still matches the parent past the point where this node leaves it.
+		matched_ = cache.offset;
+		bool greater = node_key.size() == matched_ || static_cast<unsigned char>(key_[matched_]) > (cache.bytes >> 56);
+		order_ = greater ? 1 : -1;
+		return order_;
+	  }
+	  std::uint64_t bytes = load(key_, matched_);
+	  if (bytes != cache.bytes) {
+		std::size_t length = std::min(key_.size(), node_key.size());
+		matched_ = std::min(matched_ + std::countl_zero(bytes ^ cache.bytes) / 8, length);
+		order_ = bytes < cache.bytes ? -1 : 1;
+		return order_;
+	  }
+	  matched_ = common_prefix(key_, node_key, std::min({matched_ + 8, key_.size(), node_key.size()}));
+	  return finish(node_key);
+	}
+
+   private:
+	// Orders the probe against node_key once their common prefix, matched_, is known.
+	int finish(const std::string& node_key) {
+	  if (matched_ < key_.size() && matched_ < node_key.size()) {
+		order_ = static_cast<unsigned char>(key_[matched_]) < static_cast<unsigned char>(node_key[matched_]) ? -1 : 1;
+	  } else {
+		order_ = key_.size() < node_key.size() ? -1 : (node_key.size() < key_.size() ? 1 : 0);
+	  }
+	  return order_;
+	}
+
+	const std::string& key_;
+	std::size_t matched_;
+	int order_;
+  };
+};
+
+// Orders strings exactly like std::less<std::string>; picking it as Compare opts the tree into
+// string_prefix_cache, which pays off for long keys with shared prefixes at 16 bytes per node.
+struct prefix_less : std::less<std::string> {};
+
+template <>
+struct key_prefix_cache<std::string, prefix_less> : string_prefix_cache {};
+
+enum class ReclaimMode {
+  Immediate,
+  Deferred,
+  Background
+};
+
+// The one worker thread that frees nodes for every tree in ReclaimMode::Background. It starts on
+// the first job and is joined at exit once the queue is empty. Jobs that cannot be queued, because
+// the worker could not start or has already been joined, are left to the caller to run.
+class background_reclaimer {
+ public:
+  static bool post(std::function<void()>&& job) noexcept {
+	if (closed_.load(std::memory_order_acquire)) {
+	  return false;
+	}
+	try {
+	  return instance().push(std::move(job));
+	} catch (...) {
+	  return false;
+	}
+  }
+
+  // Blocks until every job queued so far has run. Call it before destroying anything the
+  // allocators of background trees refer to, e.g. a memory resource.
+  static void drain() {
+	if (!closed_.load(std::memory_order_acquire)) {
+	  instance().wait_idle();
+	}
+  }
+
+  ~background_reclaimer() {
+	{
+	  std::lock_guard<std::mutex> lock(mutex_);
+	  stopping_ = true;
+	}
+	wake_.notify_all();
+	if (worker_.joinable()) {
+	  worker_.join();
+	}
+	closed_.store(true, std::memory_order_release);
+  }
+
+ private:
+  background_reclaimer() = default;
+
+  static background_reclaimer& instance() {
+	static background_reclaimer reclaimer;
+	return reclaimer;
+  }
+
+  bool push(std::function<void()>&& job) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (stopping_) {
+	  return false;
+	}
+	if (!worker_.joinable()) {
+	  worker_ = std::thread([this] { run(); });
+	}
+	jobs_.push_back(std::move(job));
+	wake_.notify_one();
+	return true;
+  }
+
+  void run() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+	  wake_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+	  if (jobs_.empty()) {
+		return;
+	  }
+	  std::function<void()> job = std::move(jobs_.front());
+	  jobs_.pop_front();
+	  busy_ = true;
+	  lock.unlock();
+	  job();
+	  lock.lock();
+	  busy_ = false;
+	  idle_.notify_all();
+	}
+  }
+
+  void wait_idle() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	idle_.wait(lock, [this] { return jobs_.empty() && !busy_; });
+  }
+
+  static inline std::atomic<bool> closed_{false};
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+  std::deque<std::function<void()>> jobs_;
+  std::thread worker_;
+  bool stopping_ = false;
+  bool busy_ = false;
+};
+
+// Persistent helper threads for the parallel traversals, started on demand and joined at exit. A
+// caller queues one request per helper it wants and runs the job itself too; before returning it
+// withdraws the requests no helper has picked up, so it never waits on a pool busy elsewhere, and
+// nested parallel calls cannot deadlock. If threads cannot be started, fewer helpers join in.
+class parallel_workers {
+ public:
+  // Runs job on the calling thread and on up to helpers pool threads, returning once every copy
+  // that started has finished. job must not throw and must return once no work is left.
+  static void run(std::size_t helpers, const std::function<void()>& job) {
+	if (helpers == 0 || closed_.load(std::memory_order_acquire)) {
+	  job();
+	  return;
+	}
+	instance().share(helpers, job);
+  }
+
+  ~parallel_workers() {
+	{
+	  std::lock_guard<std::mutex> lock(mutex_);
+	  stopping_ = true;
+	}
+	wake_.notify_all();
+	for (std::thread& worker : workers_) {
+	  worker.join();
+	}
+	closed_.store(true, std::memory_order_release);
+  }
+
+ private:
+  struct group {
+	const std::function<void()>* job;
+	std::size_t running;
+  };
+
+  parallel_workers() = default;
+
+  static parallel_workers& instance() {
+	static parallel_workers workers;
+	return workers;
+  }
+
+  void share(std::size_t helpers, const std::function<void()>& job) {
+	group shared = {&job, 0};
+	{
+	  std::lock_guard<std::mutex> lock(mutex_);
+	  if (!stopping_) {
+		try {
+		  while (workers_.size() < helpers) {
+			workers_.emplace_back([this] { serve(); });
+		  }
+		} catch (...) {
+		}
+		try {
+		  for (std::size_t i = 0; i < std::min(helpers, workers_.size()); ++i) {
+			requests_.push_back(&shared);
+		  }
+		} catch (...) {
+		}
+	  }
+	}
+	wake_.notify_all();
+	job();
+	std::unique_lock<std::mutex> lock(mutex_);
+	std::erase(requests_, &shared);
+	done_.wait(lock, [&shared] { return shared.running == 0; });
+  }
+
+  void serve() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+	  wake_.wait(lock, [this] { return stopping_ || !requests_.empty(); });
+	  if (requests_.empty()) {
+		return;
+	  }
+	  group* request = requests_.front();
+	  requests_.pop_front();
+	  ++request->running;
+	  lock.unlock();
+	  (*request->job)();
+	  lock.lock();
+	  --request->running;
+	  done_.notify_all();
+	}
+  }
+
+  static inline std::atomic<bool> closed_{false};
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  std::deque<group*> requests_;
+  std::vector<std::thread> workers_;
+  bool stopping_ = false;
+};
+
+// Augmentation policy for interval trees: every node keeps the largest right endpoint of its subtree.
+template <typename T>
+struct interval_augment {
+  using summary_type = T;
+
+  T project(const std::pair<T, T>& interval) const {
+	return interval.second;
+  }
+
+  T combine(const T& lhs, const T& rhs) const {
+	return lhs < rhs ? rhs : lhs;
+  }
+};
+
+// Augmentation policy folding Projection(value) over every subtree with a user monoid, which provides
+// a static identity() and a combine operator(); combine need not be commutative.
+template <typename Monoid, typename Projection>
+struct monoid_augment {
+  using summary_type = decltype(Monoid::identity());
+
+  static summary_type identity() {
+	return Monoid::identity();
+  }
+
+  template <typename Value>
+  summary_type project(const Value& value) const {
+	return Projection()(value);
+  }
+
+  summary_type combine(const summary_type& lhs, const summary_type& rhs) const {
+	return Monoid()(lhs, rhs);
+  }
+};
+
+template <typename T>
+struct sum_monoid {
+  static T identity() {
+	return T();
+  }
+
+  T operator()(const T& lhs, const T& rhs) const {
+	return lhs + rhs;
+  }
+};
+
+template <typename T>
+struct min_monoid {
+  static T identity() {
+	return std::numeric_limits<T>::max();
+  }
+
+  T operator()(const T& lhs, const T& rhs) const {
+	return rhs < lhs ? rhs : lhs;
+  }
+};
+
+template <typename T>
+struct max_monoid {
+  static T identity() {
+	return std::numeric_limits<T>::lowest();
+  }
+
+  T operator()(const T& lhs, const T& rhs) const {
+	return lhs < rhs ? rhs : lhs;
+  }
+};
+
+template <typename Augment>
+struct is_interval_augment : std::false_type {};
+
+template <typename T>
+struct is_interval_augment<interval_augment<T>> : std::true_type {};
+
+template <typename Augment>
+struct augment_summary {
+  using type = typename Augment::summary_type;
+};
+
+template <>
+struct augment_summary<void> {
+  struct type {};
+};
+
+template <typename Key, typename Compare = std::less<Key>, typename Allocator = std::allocator<Key>, typename Mapped = void, typename Augment = void>
 class bst {
  public:
   using key_type = Key;
-  using value_type = Key;
+  using mapped_type = Mapped;
+  using value_type = typename std::conditional<std::is_void_v<Mapped>, Key, std::pair<const Key, Mapped>>::type;
   using key_compare = Compare;
   using value_compare = Compare;
   using size_type = std::size_t;
-  using reference = Key&;
-  using const_reference = const Key&;
-  using pointer = Key*;
-  using const_pointer = const Key*;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using pointer = value_type*;
+  using const_pointer = const value_type*;
+  using summary_type = typename augment_summary<Augment>::type;
+  using key_cache = key_prefix_cache<Key, Compare>;
   struct node;
   using node_type = node*;
   using allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<node>;
@@ -30,12 +437,26 @@ class bst {
 	node_type left;
 	node_type right;
 	node_type parent;
+	[[no_unique_address]] summary_type summary;
+	[[no_unique_address]] typename key_cache::type prefix;
 
 	node(const_reference data)
 		: data(data)
 		, left(nullptr)
 		, right(nullptr)
 		, parent(nullptr)
+		, summary()
+		, prefix()
+	{}
+
+	template <typename... Args>
+	node(std::in_place_t, Args&&... args)
+		: data(std::forward<Args>(args)...)
+		, left(nullptr)
+		, right(nullptr)
+		, parent(nullptr)
+		, summary()
+		, prefix()
 	{}
 
 	node_type get_largest(node_type root) const {
@@ -110,17 +531,33 @@ class bst {
   template<bool IsConst>
   class base_iterator {
    public:
-	using iterator_type = typename std::conditional<IsConst, typename bst<value_type>::const_iterator, typename bst<value_type>::iterator>::type;
+	using iterator_type = base_iterator;
+	// Keys are never writable through an iterator; only bst_map exposes its mapped values.
+	using iterator_reference = typename std::conditional<IsConst || std::is_void_v<Mapped>, const_reference, reference>::type;
+	using iterator_pointer = typename std::conditional<IsConst || std::is_void_v<Mapped>, const_pointer, pointer>::type;
+
 	base_iterator(node_type root, node_type current, TraversalType type = TraversalType::InOrder)
 		: root_(root)
 		, current_(current)
 		, traversal_type_(type)
 	{}
 
-	const_reference operator*() const {
+	template <bool C = IsConst>
+	requires C
+	base_iterator(const base_iterator<false>& other)
+		: root_(other.root_)
+		, current_(other.current_)
+		, traversal_type_(other.traversal_type_)
+	{}
+
+	iterator_reference operator*() const {
 	  return current_->data;
 	}
 
+	iterator_pointer operator->() const {
+	  return &current_->data;
+	}
+
 	iterator_type& operator++() {
 	  switch (traversal_type_) {
 		case TraversalType::InOrder:
@@ -160,7 +597,7 @@ class bst {
 			if (current_->parent->right){
 			  current_ = current_->parent->right->get_min_leaf();
 			} else {
-			  current_->parent;
+			  current_ = current_->parent;
 			}
 		  }
 		  break;
@@ -169,7 +606,7 @@ class bst {
 	}
 
 	iterator_type operator++(int) {
-	  iterator temp = *this;
+	  iterator_type temp = *this;
 	  ++(*this);
 	  return temp;
 	}
@@ -241,7 +678,7 @@ class bst {
 	}
 
 	iterator_type operator--(int) {
-	  iterator temp = *this;
+	  iterator_type temp = *this;
 	  --(*this);
 	  return temp;
 	}
@@ -255,6 +692,9 @@ class bst {
 	}
 
    private:
+	friend class bst;
+	template <bool> friend class base_iterator;
+
 	node_type root_;
 	node_type current_;
 	TraversalType traversal_type_;
@@ -267,23 +707,27 @@ class bst {
   class base_reverse_iterator {
    public:
 	using iterator_type = typename base_iterator<IsConst>::iterator_type;
-	using reverse_iterator_type = typename std::conditional<IsConst, typename bst<value_type>::const_reverse_iterator, typename bst<value_type>::reverse_iterator>::type;
+	using reverse_iterator_type = base_reverse_iterator;
 
 	base_reverse_iterator(iterator_type iter)
 		: current(iter)
 	{}
 
-	const_reference operator*() const {
+	typename iterator_type::iterator_reference operator*() const {
 	  return *current;
 	}
 
+	typename iterator_type::iterator_pointer operator->() const {
+	  return current.operator->();
+	}
+
 	reverse_iterator_type& operator++() {
 	  --current;
 	  return *this;
 	}
 
 	reverse_iterator_type operator++(int) {
-	  reverse_iterator temp = *this;
+	  reverse_iterator_type temp = *this;
 	  --current;
 	  return temp;
 	}
@@ -299,6 +743,10 @@ class bst {
 	  return temp;
 	}
 
+	iterator_type base() const {
+	  return current;
+	}
+
 	bool operator==(const reverse_iterator_type& other) {
 	  return this->current == other.current;
 	}
@@ -314,21 +762,90 @@ class bst {
   using const_reverse_iterator = base_reverse_iterator<true>;
   using reverse_iterator = base_reverse_iterator<false>;
 
+  // Lazily walks, in key order, the intervals overlapping [lo, hi]; only for interval_augment trees.
+  class overlap_iterator {
+   public:
+	using endpoint_type = typename Key::first_type;
+
+	overlap_iterator(node_type current, const endpoint_type& lo, const endpoint_type& hi)
+		: current_(current)
+		, lo_(lo)
+		, hi_(hi)
+	{}
+
+	const_reference operator*() const {
+	  return current_->data;
+	}
+
+	const_pointer operator->() const {
+	  return &current_->data;
+	}
+
+	overlap_iterator& operator++() {
+	  current_ = next_overlap(current_, lo_, hi_);
+	  return *this;
+	}
+
+	overlap_iterator operator++(int) {
+	  overlap_iterator temp = *this;
+	  ++(*this);
+	  return temp;
+	}
+
+	bool operator!=(const overlap_iterator& other) const {
+	  return current_ != other.current_;
+	}
+
+	bool operator==(const overlap_iterator& other) const {
+	  return current_ == other.current_;
+	}
+
+   private:
+	node_type current_;
+	endpoint_type lo_;
+	endpoint_type hi_;
+  };
+
+  struct overlap_range {
+	overlap_iterator first;
+	overlap_iterator last;
+
+	overlap_iterator begin() const {
+	  return first;
+	}
+
+	overlap_iterator end() const {
+	  return last;
+	}
+  };
+
   bst()
 	  : root_(nullptr)
 	  , size_(0)
+	  , peak_size_(0)
+	  , reclaim_mode_(ReclaimMode::Immediate)
+	  , write_buffer_limit_(0)
   {}
 
-  bst(const bst<value_type>& other)
+  // Pending buffered writes are copied as they are, so copying never writes to other.
+  bst(const bst& other)
 	  : size_(other.size_)
+	  , peak_size_(size_)
+	  , reclaim_mode_(other.reclaim_mode_)
+	  , write_buffer_limit_(other.write_buffer_limit_)
 	  , compare_(other.compare_)
-	  , allocator_(alloc_traits::select_on_container_copy_construction(other.allocator_)) {
+	  , allocator_(alloc_traits::select_on_container_copy_construction(other.allocator_))
+	  , pending_writes_(other.pending_writes_)
+	  , write_tail_(other.write_tail_) {
 	root_ = copy(other.root_, nullptr, allocator_);
   }
 
   bst(const std::initializer_list<value_type> il) {
 	root_ = nullptr;
 	size_ = 0;
+	peak_size_ = 0;
+	reclaim_mode_ = ReclaimMode::Immediate;
+	write_buffer_limit_ = 0;
 	for (auto it = il.begin(); it != il.end(); ++it) {
 	  insert(*it);
 	}
@@ -337,16 +854,18 @@ class bst {
   bst(iterator begin, iterator end) {
 	root_ = nullptr;
 	size_ = 0;
+	peak_size_ = 0;
+	reclaim_mode_ = ReclaimMode::Immediate;
+	write_buffer_limit_ = 0;
 	for (auto it = begin; it != end; ++it) {
 	  insert(*it);
 	}
   }
 
-  bst& operator=(const bst<value_type>& other) {
+  bst& operator=(const bst& other) {
 	if (this == &other) {
 	  return *this;
 	}
-
 	allocator_type new_alloc = alloc_traits::propagate_on_container_copy_assignment::value
 							   ? other.allocator_ : allocator_;
 	node_type new_root = copy(other.root_, nullptr, new_alloc);
@@ -354,7 +873,13 @@ class bst {
 	root_ = new_root;
 	allocator_ = new_alloc;
 	size_ = other.size_;
+	peak_size_ = size_;
 	compare_ = other.compare_;
+	pending_writes_ = other.pending_writes_;
+	write_tail_ = other.write_tail_;
+	if (write_buffer_limit_ == 0) {
+	  flush();
+	}
 
 	return *this;
   }
@@ -369,13 +894,15 @@ class bst {
 	return *this;
   }
 
-  bool operator==(const bst<value_type>& other) const {
+  bool operator==(const bst& other) const {
+	expect_flushed();
+	other.expect_flushed();
 	if (size_ != other.size_) {
 	  return false;
 	}
 
-	iterator lhs = this->begin();
-	iterator rhs = other.begin();
+	const_iterator lhs = this->begin();
+	const_iterator rhs = other.begin();
 
 	while (lhs != end() && rhs != other.end() && *lhs == *rhs) {
 	  ++lhs;
@@ -384,43 +911,70 @@ class bst {
 	return lhs == end() && rhs == other.end();
   }
 
-  bool operator!=(const bst<value_type>& other) const {
+  bool operator!=(const bst& other) const {
 	return !(*this == other);
   }
 
-  iterator begin(TraversalType type = TraversalType::InOrder) const {
+  const_iterator begin(TraversalType type = TraversalType::InOrder) const {
+	expect_flushed();
 	switch (type) {
 	  case TraversalType::InOrder:
-		return iterator(root_, root_->get_min_node(), TraversalType::InOrder);
+		return const_iterator(root_, root_->get_min_node(), TraversalType::InOrder);
 	  case TraversalType::PreOrder:
-		return iterator(root_, root_, TraversalType::PreOrder);
+		return const_iterator(root_, root_, TraversalType::PreOrder);
 	  case TraversalType::PostOrder:
-		return iterator(root_, root_->get_min_leaf(), TraversalType::PostOrder);
+		return const_iterator(root_, root_->get_min_leaf(), TraversalType::PostOrder);
 	}
-	return iterator(root_, nullptr, type);
+	return const_iterator(root_, nullptr, type);
   }
 
-  iterator end(TraversalType type = TraversalType::InOrder) const {
-	return iterator(root_, nullptr, type);
+  const_iterator end(TraversalType type = TraversalType::InOrder) const {
+	expect_flushed();
+	return const_iterator(root_, nullptr, type);
   }
 
-  reverse_iterator rbegin(TraversalType type = TraversalType::InOrder) const {
+  const_reverse_iterator rbegin(TraversalType type = TraversalType::InOrder) const {
+	expect_flushed();
 	switch (type) {
 	  case TraversalType::InOrder:
-		return reverse_iterator(iterator(root_, root_->get_max_node(), TraversalType::InOrder));
+		return const_reverse_iterator(const_iterator(root_, root_->get_max_node(), TraversalType::InOrder));
 	  case TraversalType::PreOrder:
-		return reverse_iterator(iterator(root_, root_->get_max_leaf(), TraversalType::PreOrder));
+		return const_reverse_iterator(const_iterator(root_, root_->get_max_leaf(), TraversalType::PreOrder));
 	  case TraversalType::PostOrder:
-		return reverse_iterator(iterator(root_, root_, TraversalType::PostOrder));
+		return const_reverse_iterator(const_iterator(root_, root_, TraversalType::PostOrder));
 	}
-	return reverse_iterator(iterator(root_, nullptr, type));
+	return const_reverse_iterator(const_iterator(root_, nullptr, type));
+  }
+
+  const_reverse_iterator rend(TraversalType type = TraversalType::InOrder) const {
+	expect_flushed();
+	return const_reverse_iterator(const_iterator(root_, nullptr, type));
+  }
+
+  // A const tree only hands out const iterators, so bst_map values cannot be changed through it.
+  // The non-const overloads apply buffered writes first; see set_write_buffer().
+  iterator begin(TraversalType type = TraversalType::InOrder) {
+	flush();
+	return unconst(std::as_const(*this).begin(type));
+  }
+
+  iterator end(TraversalType type = TraversalType::InOrder) {
+	flush();
+	return unconst(std::as_const(*this).end(type));
+  }
+
+  reverse_iterator rbegin(TraversalType type = TraversalType::InOrder) {
+	flush();
+	return reverse_iterator(unconst(std::as_const(*this).rbegin(type).base()));
   }
 
-  reverse_iterator rend(TraversalType type = TraversalType::InOrder) const {
-	return reverse_iterator(iterator(root_, nullptr, type));
+  reverse_iterator rend(TraversalType type = TraversalType::InOrder) {
+	flush();
+	return reverse_iterator(unconst(std::as_const(*this).rend(type).base()));
   }
 
   const_iterator cbegin(TraversalType type = TraversalType::InOrder) const {
+	expect_flushed();
 	switch (type) {
 	  case TraversalType::InOrder:
 		return const_iterator(root_, root_->get_min_node(), TraversalType::InOrder);
@@ -433,10 +987,12 @@ class bst {
   }
 
   const_iterator cend(TraversalType type = TraversalType::InOrder) const {
+	expect_flushed();
 	return const_iterator(root_, nullptr, type);
   }
 
   const_reverse_iterator crbegin(TraversalType type = TraversalType::InOrder) const {
+	expect_flushed();
 	switch (type) {
 	  case TraversalType::InOrder:
 		return const_reverse_iterator(const_iterator(root_, root_->get_max_node(), TraversalType::InOrder));
@@ -449,10 +1005,11 @@ class bst {
   }
 
   const_reverse_iterator crend(TraversalType type = TraversalType::InOrder) const {
+	expect_flushed();
 	return const_reverse_iterator(const_iterator(root_, nullptr, type));
   }
 
-  void swap(bst<value_type>& other) {
+  void swap(bst& other) {
 	if constexpr (alloc_traits::propagate_on_container_swap::value) {
 	  std::swap(allocator_, other.allocator_);
 	  bst tmp = *this;
@@ -462,6 +1019,7 @@ class bst {
   }
 
   size_type size() const {
+	expect_flushed();
 	return size_;
   }
 
@@ -470,6 +1028,7 @@ class bst {
   }
 
   bool empty() const {
+	expect_flushed();
 	return (size_ == 0);
   }
 
@@ -492,19 +1051,25 @@ class bst {
   }
 
   node_type extract (iterator target) {
-	return extract(*target);
+	return extract(key_of(*target));
   }
 
-  node_type extract (value_type value) {
-	node_type extracted_node = find_node(value, root_);
+  node_type extract (const key_type& key) {
+	flush();
+	node_type extracted_node = find_node(key, root_);
 	if (extracted_node) {
 	  remove_node(extracted_node);
 	}
 	return extracted_node;
   }
 
-  size_type erase(value_type value) {
-	node_type removed_node = find_node(value, root_);
+  size_type erase(const key_type& key) {
+	if (write_buffer_limit_ != 0) {
+	  size_type erased = contains(key) ? 1 : 0;
+	  buffer_write(key, std::nullopt);
+	  return erased;
+	}
+	node_type removed_node = find_node(key, root_);
 	if (removed_node) {
 	  remove_node(removed_node);
 	  return 1;
@@ -513,10 +1078,11 @@ class bst {
   }
 
   iterator erase(iterator target) {
-	node_type removed_node = find_node(*target, root_);
+	flush();
+	node_type removed_node = find_node(key_of(*target), root_);
 	if (removed_node) {
-	  remove_node(removed_node);
 	  ++target;
+	  remove_node(removed_node);
 	  return target;
 	}
 	return end();
@@ -531,189 +1097,1463 @@ class bst {
 
   void merge(bst& other) {
 	for (const auto& element : other) {
-	  auto it = find(element);
+	  auto it = find(key_of(element));
 	  if (it == end()) {
 		insert(element);
 	  }
 	}
   }
 
-  iterator find(value_type value) const {
-	node_type target = find_node(value, root_);
-	return iterator(root_, target);
+  const_iterator find(const key_type& key) const {
+	expect_flushed();
+	node_type target = find_node(key, root_);
+	return const_iterator(root_, target);
   }
 
-  bool contains(value_type value) const {
-	return find_node(value, root_) != nullptr;
+  iterator find(const key_type& key) {
+	flush();
+	return unconst(std::as_const(*this).find(key));
   }
 
-  size_type count(value_type value) const {
-	return find_node(value, root_) == nullptr ? 0 : 1;
+  bool contains(const key_type& key) const {
+	if (const write_op* op = find_write(write_tail_, key)) {
+	  return op->value.has_value();
+	}
+	if (const write_op* op = find_write(pending_writes_, key)) {
+	  return op->value.has_value();
+	}
+	return find_node(key, root_) != nullptr;
+  }
+
+  size_type count(const key_type& key) const {
+	return contains(key) ? 1 : 0;
   }
 
-  iterator upper_bound(value_type value) const {
+  const_iterator upper_bound(const key_type& key) const {
+	expect_flushed();
 	node_type current = root_;
 	node_type upper_bound_node = nullptr;
+	key_search search(*this, key);
 
 	while (current != nullptr) {
-	  if (compare_(value, current->data)) {
+	  if (search.less(current)) {
 		upper_bound_node = current;
 		current = current->left;
 	  } else {
 		current = current->right;
 	  }
 	}
-	return iterator(root_, upper_bound_node);
+	return const_iterator(root_, upper_bound_node);
   }
 
-  iterator lower_bound(value_type value) const {
+  const_iterator lower_bound(const key_type& key) const {
+	expect_flushed();
 	node_type current = root_;
 	node_type lower_bound_node = nullptr;
+	key_search search(*this, key);
 
 	while (current != nullptr) {
-	  if (compare_(value, current->data) || value == current->data) {
+	  if (search.less_equal(current)) {
 		lower_bound_node = current;
 		current = current->left;
 	  } else {
 		current = current->right;
 	  }
 	}
-	return iterator(root_, lower_bound_node);
+	return const_iterator(root_, lower_bound_node);
   }
 
-  void insert(const_reference x) {
-	insert(root_, nullptr, x);
-  }
-
-  void clear () {
-	clear(root_);
+  iterator upper_bound(const key_type& key) {
+	flush();
+	return unconst(std::as_const(*this).upper_bound(key));
   }
 
-  ~bst() {
-	clear();
+  iterator lower_bound(const key_type& key) {
+	flush();
+	return unconst(std::as_const(*this).lower_bound(key));
   }
 
- private:
-  void insert(node_type& root, node_type parent, const_reference x) {
-	if (root == nullptr) {
-	  root = alloc_traits::allocate(allocator_, 1);
-	  alloc_traits::construct(allocator_, root, x);
-	  root->parent = parent;
-	  ++size_;
-	  return;
+  // Folds the summaries of all values with keys in [lo, hi) in key order, in one descent per bound.
+  template <typename A = Augment>
+  requires requires { A::identity(); }
+  summary_type aggregate(const key_type& lo, const key_type& hi) const {
+	expect_flushed();
+	node_type split = root_;
+	while (split != nullptr) {
+	  if (compare_(key_of(split->data), lo)) {
+		split = split->right;
+	  } else if (!compare_(key_of(split->data), hi)) {
+		split = split->left;
+	  } else {
+		break;
+	  }
 	}
-	if (compare_(x, root->data)) {
-	  insert(root->left, root, x);
-	} else if (!compare_(x, root->data)) {
-	  insert(root->right, root, x);
+	if (split == nullptr) {
+	  return A::identity();
 	}
-  }
 
-  void remove_node(node_type& node) {
-	if (node->left == nullptr) {
-	  node_type temp = node->right;
-	  if (temp) temp->parent = node->parent;
-	  if (node->parent) {
-		if (node->parent->left == node) {
-		  node->parent->left = temp;
-		} else {
-		  node->parent->right = temp;
-		}
-	  } else {
-		root_ = temp;
-	  }
-	  alloc_traits::destroy(allocator_, node);
-	  alloc_traits::deallocate(allocator_, node, 1);
-	  --size_;
-	  node = temp;
-	} else if (node->right == nullptr) {
-	  node_type temp = node->left;
-	  if (temp) temp->parent = node->parent;
-	  if (node->parent) {
-		if (node->parent->left == node) {
-		  node->parent->left = temp;
-		} else {
-		  node->parent->right = temp;
-		}
+	A augment;
+	summary_type from_lo = A::identity();
+	for (node_type node = split->left; node != nullptr;) {
+	  if (compare_(key_of(node->data), lo)) {
+		node = node->right;
 	  } else {
-		root_ = temp;
+		from_lo = augment.combine(augment.combine(augment.project(node->data), summary_of(node->right)), from_lo);
+		node = node->left;
 	  }
-	  alloc_traits::destroy(allocator_, node);
-	  alloc_traits::deallocate(allocator_, node, 1);
-	  --size_;
-	  node = temp;
-	} else {
-	  node_type temp = next(node);
-	  remove_node(temp);
-	  node->data = temp->data;
-	  if (temp->right) {
-		remove_node(temp->right);
+	}
+	summary_type to_hi = A::identity();
+	for (node_type node = split->right; node != nullptr;) {
+	  if (compare_(key_of(node->data), hi)) {
+		to_hi = augment.combine(to_hi, augment.combine(summary_of(node->left), augment.project(node->data)));
+		node = node->right;
 	  } else {
-		if (temp->parent) {
-		  if (temp->parent->left == temp) {
-			temp->parent->left = nullptr;
-		  } else {
-			temp->parent->right = nullptr;
-		  }
-		}
-		alloc_traits::destroy(allocator_, temp);
-		alloc_traits::deallocate(allocator_, temp, 1);
-		--size_;
+		node = node->left;
 	  }
 	}
+	return augment.combine(augment.combine(from_lo, augment.project(split->data)), to_hi);
   }
 
-  node_type next(node_type node) const {
-	node_type target = nullptr;
-	value_type key = node->data;
-	while (node != nullptr) {
-	  if (node->data > key) {
-		target = node;
-		node = node->left;
-	  } else {
-		node = node->right;
-	  }
+  template <typename A = Augment>
+  requires is_interval_augment<A>::value
+  overlap_range overlapping(const typename A::summary_type& lo, const typename A::summary_type& hi) const {
+	expect_flushed();
+	return {overlap_iterator(first_overlap(root_, lo, hi), lo, hi), overlap_iterator(nullptr, lo, hi)};
+  }
+
+  template <typename A = Augment>
+  requires is_interval_augment<A>::value
+  bool any_overlap(const typename A::summary_type& lo, const typename A::summary_type& hi) const {
+	expect_flushed();
+	return first_overlap(root_, lo, hi) != nullptr;
+  }
+
+  void insert(const_reference x) {
+	if (write_buffer_limit_ != 0) {
+	  buffer_write(key_of(x), x);
+	  return;
 	}
-	return target;
+	emplace_node(key_of(x), x);
   }
 
-  node_type find_node(value_type value, node_type current_node) const {
-	while (current_node != nullptr) {
-	  if (value == current_node->data) {
+  template <typename M = Mapped, typename... Args>
+  requires (!std::is_void_v<M>)
+  std::pair<iterator, bool> try_emplace(const key_type& key, Args&&... args) {
+	flush();
+	auto [target, inserted] = emplace_node(key, std::piecewise_construct, std::forward_as_tuple(key),
+										   std::forward_as_tuple(std::forward<Args>(args)...));
+	return {iterator(root_, target), inserted};
+  }
+
+  template <typename Obj, typename M = Mapped>
+  requires (!std::is_void_v<M>)
+  std::pair<iterator, bool> insert_or_assign(const key_type& key, Obj&& obj) {
+	flush();
+	auto [target, inserted] = emplace_node(key, key, std::forward<Obj>(obj));
+	if (!inserted) {
+	  target->data.second = std::forward<Obj>(obj);
+	}
+	return {iterator(root_, target), inserted};
+  }
+
+  template <typename M = Mapped>
+  requires (!std::is_void_v<M>)
+  M& operator[](const key_type& key) {
+	flush();
+	return emplace_node(key, std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>()).first->data.second;
+  }
+
+  // Bulk path for streaming ingest of a range sorted by Compare. Keys past the current maximum are
+  // linked in as one balanced subtree; earlier keys, if any, go through the regular insert.
+  template <typename ForwardIt>
+  void append_sorted(ForwardIt first, ForwardIt last) {
+	flush();
+	node_type max_node = max_node_hint();
+	while (first != last && max_node && !compare_(key_of(max_node->data), key_of(*first))) {
+	  insert(*first);
+	  ++first;
+	}
+	if (first == last) {
+	  return;
+	}
+
+	size_type count = 1;
+	for (ForwardIt prev = first, it = std::next(first); it != last; prev = it, ++it) {
+	  if (compare_(key_of(*prev), key_of(*it))) {
+		++count;
+	  }
+	}
+	node_type subtree = build_sorted(first, last, count, max_node);
+	if (max_node) {
+	  max_node->right = subtree;
+	} else {
+	  root_ = subtree;
+	}
+	size_ += count;
+	update_path(max_node);
+	node_type new_max = subtree->get_max_node();
+	finger_.clear();
+	finger_.push_back({new_max, new_max->parent, nullptr});
+	restore_balance(deepest_built(subtree, count));
+  }
+
+  // Deferred: clear() only detaches the nodes, which are freed by later reclaim() calls.
+  // Background: clear() and the destructor hand the nodes to background_reclaimer's worker thread,
+  // so both the value destructors and the allocator run there, concurrently with this tree's own
+  // allocations. It is therefore only used with allocators whose instances all compare equal, such
+  // as std::allocator; trees with stateful allocators, and trees under background_threshold nodes
+  // (where queueing would cost more), are freed on the spot.
+  void set_reclaim_mode(ReclaimMode mode) {
+	reclaim_mode_ = mode;
+  }
+
+  ReclaimMode reclaim_mode() const {
+	return reclaim_mode_;
+  }
+
+  // Frees at most budget nodes detached by earlier clear() calls; returns how many were freed.
+  size_type reclaim(size_type budget) {
+	return release(retired_, retired_blocks_, allocator_, budget);
+  }
+
+  bool reclaim_pending() const {
+	return !retired_.empty();
+  }
+
+  // Buffered mode: insert(value) and erase(key) go to an operation log of up to limit keys, drained
+  // by flush() in one sorted pass that shares descents. contains() and count() binary-search the log,
+  // and the non-const begin(), end(), find() and bounds flush it first. Other const observers never
+  // write to the tree, so they stay safe to call from several threads, and require flush() to have
+  // been called since the last buffered write (checked by an assert). A limit of 0 writes through.
+  void set_write_buffer(size_type limit) {
+	write_buffer_limit_ = limit;
+	if (limit == 0) {
+	  flush();
+	}
+  }
+
+  void flush() {
+	merge_tail();
+	if (pending_writes_.empty()) {
+	  return;
+	}
+	merge_writes();
+	pending_writes_.clear();
+  }
+
+  // Moves every node into freshly allocated blocks of up to compaction_segment (4096) nodes, laid out
+  // in the given traversal order, so scans in that order walk memory sequentially. Invalidates
+  // iterators.
+  void compact(TraversalType order = TraversalType::InOrder) {
+	start_compaction(order);
+	compact_step(std::numeric_limits<size_type>::max());
+  }
+
+  // Same, but in van Emde Boas order, which keeps every root-to-leaf path within few cache lines.
+  void compact_van_emde_boas() {
+	start_van_emde_boas_compaction();
+	compact_step(std::numeric_limits<size_type>::max());
+  }
+
+  // Incremental form: start_*compaction() only sets up the pass and compact_step(budget) moves at
+  // most budget nodes, returning true once compaction is over. The van Emde Boas layout is planned
+  // as it goes, so a step never walks the whole tree: moving k nodes takes O(k * height) at worst.
+  // Each block is sized by the nodes still to move and freed once its last node is. The tree stays
+  // fully usable between steps: an erased node's place in the layout passes to the node that takes
+  // its place in the tree, and nodes inserted meanwhile are moved too when the pass reaches them.
+  void start_compaction(TraversalType order = TraversalType::InOrder) {
+	open_compaction();
+	compaction_.order = order;
+	compaction_.van_emde_boas = false;
+	compaction_.cursor = first_in(order);
+  }
+
+  void start_van_emde_boas_compaction() {
+	open_compaction();
+	compaction_.van_emde_boas = true;
+	if (root_) {
+	  compaction_.plan.push_back({root_, 0, layout_height(), true});
+	}
+  }
+
+  bool compact_step(size_type budget) {
+	if (!compaction_.active) {
+	  return true;
+	}
+	for (size_type moved = 0; moved < budget; ++moved) {
+	  node_type next = compaction_.moved < size_ ? next_to_compact() : nullptr;
+	  if (next == nullptr) {
+		finish_compaction();
+		return true;
+	  }
+	  if (compaction_.block.used == compaction_.block.capacity) {
+		seal_segment();
+		size_type capacity = std::min(size_ - compaction_.moved, compaction_segment);
+		compaction_.block = {alloc_traits::allocate(allocator_, capacity), capacity, 0, 0, compaction_.pass};
+	  }
+	  relocate(next, compaction_.block);
+	}
+	return false;
+  }
+
+  // Calls fn(value) for every value on up to `threads` threads. The tree is cut into subtrees that
+  // follow each other in the given traversal order; each is walked in that order by one thread, but
+  // different subtrees run concurrently, so fn must be safe to call in parallel. The tree must not
+  // be modified until the call returns; the first exception thrown by fn is rethrown.
+  template <typename Fn>
+  void parallel_for_each(TraversalType type, Fn fn, unsigned threads = std::thread::hardware_concurrency()) const {
+	expect_flushed();
+	std::vector<traversal_chunk> chunks = split_traversal(type, threads);
+	run_parallel(chunks.size(), threads, [&](size_type i) {
+	  visit_chunk(chunks[i], type, fn);
+	});
+  }
+
+  // Folds combine over project(value) in traversal order, in parallel. combine must be associative
+  // with `identity` as its identity element; chunk results are combined in traversal order, so it
+  // need not be commutative.
+  template <typename T, typename Combine, typename Projection = std::identity>
+  T parallel_reduce(TraversalType type, T identity, Combine combine, Projection project = {},
+					unsigned threads = std::thread::hardware_concurrency()) const {
+	expect_flushed();
+	std::vector<traversal_chunk> chunks = split_traversal(type, threads);
+	std::vector<chunk_result<T>> partial(chunks.size());
+	run_parallel(chunks.size(), threads, [&](size_type i) {
+	  T local = identity;
+	  visit_chunk(chunks[i], type, [&](const_reference value) {
+		local = combine(std::move(local), std::invoke(project, value));
+	  });
+	  partial[i].value.emplace(std::move(local));
+	});
+	T result = std::move(identity);
+	for (chunk_result<T>& slot : partial) {
+	  result = combine(std::move(result), std::move(*slot.value));
+	}
+	return result;
+  }
+
+  // Per-chunk form: cuts the traversal as parallel_for_each does and calls fn(first, last) once for
+  // every chunk, [first, last) being its range of const_iterators in that order. Returns what fn
+  // returned for each chunk, in traversal order, so per-chunk output such as a buffer of values
+  // concatenates to what a sequential walk would produce.
+  template <typename Fn>
+  auto parallel_for_each_chunk(TraversalType type, Fn fn, unsigned threads = std::thread::hardware_concurrency()) const {
+	using result_type = std::invoke_result_t<Fn&, const_iterator, const_iterator>;
+	expect_flushed();
+	std::vector<traversal_chunk> chunks = split_traversal(type, threads);
+	std::vector<chunk_result<result_type>> partial(chunks.size());
+	run_parallel(chunks.size(), threads, [&](size_type i) {
+	  node_type last = i + 1 < chunks.size() ? first_in_chunk(chunks[i + 1], type) : nullptr;
+	  partial[i].value.emplace(fn(const_iterator(root_, first_in_chunk(chunks[i], type), type),
+								  const_iterator(root_, last, type)));
+	});
+	std::vector<result_type> results;
+	results.reserve(partial.size());
+	for (chunk_result<result_type>& slot : partial) {
+	  results.push_back(std::move(*slot.value));
+	}
+	return results;
+  }
+
+  void clear () {
+	pending_writes_.clear();
+	write_tail_.clear();
+	finish_compaction();
+	bool inline_background = !alloc_traits::is_always_equal::value || (retired_.empty() && size_ < background_threshold);
+	if (root_) {
+	  retired_.push_back(root_);
+	  root_ = nullptr;
+	}
+	for (const node_block& block : blocks_) {
+	  retired_blocks_.push_back(block);
+	}
+	blocks_.clear();
+	size_ = 0;
+	peak_size_ = 0;
+	finger_.clear();
+	if (reclaim_mode_ == ReclaimMode::Immediate || (reclaim_mode_ == ReclaimMode::Background && inline_background)) {
+	  reclaim(std::numeric_limits<size_type>::max());
+	} else if (reclaim_mode_ == ReclaimMode::Background) {
+	  retire_in_background();
+	}
+  }
+
+  ~bst() {
+	clear();
+	if (reclaim_mode_ == ReclaimMode::Deferred) {
+	  reclaim(std::numeric_limits<size_type>::max());
+	}
+  }
+
+ private:
+  static iterator unconst(const_iterator it) {
+	return iterator(it.root_, it.current_, it.traversal_type_);
+  }
+
+  static const key_type& key_of(const_reference value) {
+	if constexpr (std::is_void_v<Mapped>) {
+	  return value;
+	} else {
+	  return value.first;
+	}
+  }
+
+  // Single descent: returns the node holding key, or links a node built from args in its place.
+  // Finger search: the lower part of the last descent is kept with the key range of each node's
+  // subtree. Those ranges are nested, so a binary search finds the lowest kept node whose range
+  // holds key and the descent starts there; sorted and nearly sorted streams climb and descend a
+  // few levels per insert however deep the tree is.
+  template <typename... Args>
+  std::pair<node_type, bool> emplace_node(const key_type& key, Args&&... args) {
+	auto holds = [&](const finger_entry& entry) {
+	  return (!entry.lower || compare_(key_of(entry.lower->data), key))
+		  && (!entry.upper || compare_(key, key_of(entry.upper->data)));
+	};
+	finger_.erase(std::partition_point(finger_.begin(), finger_.end(), holds), finger_.end());
+	if (finger_.empty() && root_) {
+	  finger_.push_back({root_, nullptr, nullptr});
+	}
+	if (finger_.size() > 2 * finger_depth) {
+	  finger_.erase(finger_.begin(), finger_.end() - finger_depth);
+	}
+
+	node_type parent = nullptr;
+	node_type* link = &root_;
+	node_type lower = nullptr;
+	node_type upper = nullptr;
+	if (!finger_.empty()) {
+	  parent = finger_.back().node;
+	  lower = finger_.back().lower;
+	  upper = finger_.back().upper;
+	}
+	key_search search(*this, key);
+	while (parent != nullptr) {
+	  int order = search(parent);
+	  if (order == 0) {
+		return {parent, false};
+	  }
+	  if (order < 0) {
+		upper = parent;
+		link = &parent->left;
+	  } else {
+		lower = parent;
+		link = &parent->right;
+	  }
+	  if (*link == nullptr) {
 		break;
-	  } else if (compare_(value, current_node->data)) {
-		current_node = current_node->left;
+	  }
+	  parent = *link;
+	  finger_.push_back({parent, lower, upper});
+	}
+	node_type new_node = alloc_traits::allocate(allocator_, 1);
+	alloc_traits::construct(allocator_, new_node, std::in_place, std::forward<Args>(args)...);
+	new_node->parent = parent;
+	refresh_prefix(new_node);
+	*link = new_node;
+	++size_;
+	update_path(new_node);
+	finger_.push_back({new_node, lower, upper});
+	restore_balance(new_node);
+	return {new_node, true};
+  }
+
+  // A contiguous run of nodes allocated by compaction pass number `pass`; live counts the nodes still
+  // constructed in it.
+  struct node_block {
+	node_type nodes;
+	size_type capacity;
+	size_type used;
+	size_type live;
+	size_type pass;
+
+	bool contains(node_type node) const {
+	  return !std::less<node_type>()(node, nodes) && std::less<node_type>()(node, nodes + capacity);
+	}
+  };
+
+  // A pending piece of the van Emde Boas layout: reach the nodes `depth` levels below `node`, then
+  // lay out `height` levels from each. A bottom piece goes on below its last level with a fresh layout.
+  struct layout_task {
+	node_type node;
+	size_type depth;
+	size_type height;
+	bool bottom;
+  };
+
+  struct compaction_state {
+	bool active = false;
+	bool van_emde_boas = false;
+	TraversalType order = TraversalType::InOrder;
+	node_type cursor = nullptr;
+	std::vector<layout_task> plan;
+	size_type pass = 0;
+	size_type moved = 0;
+	node_block block = {};
+  };
+
+  // A node of the finger path with the bounds its subtree's keys lie strictly between; null is unbounded.
+  struct finger_entry {
+	node_type node;
+	node_type lower;
+	node_type upper;
+  };
+
+  // Entries kept after trimming the finger path; enough to absorb local disorder in a stream.
+  static constexpr size_type finger_depth = 64;
+
+  // Logged values drop the const from the key so the log can be sorted in place.
+  using logged_value = typename std::conditional<std::is_void_v<Mapped>, Key, std::pair<Key, Mapped>>::type;
+
+  // A whole subtree, or a single node split off from the subtrees around it.
+  struct traversal_chunk {
+	node_type node;
+	bool subtree;
+  };
+
+  struct write_op {
+	key_type key;
+	std::optional<logged_value> value;
+	bool overwrite;
+  };
+
+  // Const observers read the tree alone; applying the log there would write to a tree that other
+  // threads may be reading, so they require it to be flushed instead.
+  void expect_flushed() const {
+	assert(pending_writes_.empty() && write_tail_.empty());
+  }
+
+  // The log is kept as a sorted run of unique keys plus a sorted tail of recent ones, so lookups are
+  // two binary searches. The tail is merged into the run once it outgrows the run's square root,
+  // which keeps the cost of an append amortized O(sqrt(limit)) element moves.
+  template <typename... Value>
+  void buffer_write(const key_type& key, Value&&... value) {
+	write_op op{key, std::forward<Value>(value)..., false};
+	auto it = std::lower_bound(write_tail_.begin(), write_tail_.end(), key, [this](const write_op& lhs, const key_type& k) {
+	  return compare_(lhs.key, k);
+	});
+	if (it != write_tail_.end() && !compare_(key, it->key)) {
+	  absorb(*it, std::move(op));
+	} else {
+	  write_tail_.insert(it, std::move(op));
+	}
+	if (pending_writes_.size() + write_tail_.size() >= write_buffer_limit_) {
+	  flush();
+	} else if (write_tail_.size() * write_tail_.size() > pending_writes_.size()) {
+	  merge_tail();
+	}
+  }
+
+  // Folds a later operation on the same key into an earlier one: an erase wins, an insert after an
+  // erase overwrites, and an insert after an insert keeps the first value, as it would have unbuffered.
+  static void absorb(write_op& kept, write_op&& later) {
+	if (!later.value) {
+	  kept = std::move(later);
+	} else if (!kept.value) {
+	  kept = std::move(later);
+	  kept.overwrite = true;
+	}
+  }
+
+  void merge_tail() {
+	if (write_tail_.empty()) {
+	  return;
+	}
+	std::vector<write_op> merged;
+	merged.reserve(pending_writes_.size() + write_tail_.size());
+	auto run = pending_writes_.begin();
+	for (write_op& op : write_tail_) {
+	  while (run != pending_writes_.end() && compare_(run->key, op.key)) {
+		merged.push_back(std::move(*run++));
+	  }
+	  if (run != pending_writes_.end() && !compare_(op.key, run->key)) {
+		merged.push_back(std::move(*run++));
+		absorb(merged.back(), std::move(op));
+	  } else {
+		merged.push_back(std::move(op));
+	  }
+	}
+	std::move(run, pending_writes_.end(), std::back_inserter(merged));
+	pending_writes_ = std::move(merged);
+	write_tail_.clear();
+  }
+
+  const write_op* find_write(const std::vector<write_op>& log, const key_type& key) const {
+	auto it = std::lower_bound(log.begin(), log.end(), key, [this](const write_op& lhs, const key_type& k) {
+	  return compare_(lhs.key, k);
+	});
+	return it != log.end() && !compare_(key, it->key) ? &*it : nullptr;
+  }
+
+  // Walks the tree once for the whole sorted, key-unique log: each visited node splits the remaining
+  // operations between its subtrees, and inserts reaching an empty slot are linked as a balanced subtree.
+  void merge_writes() {
+	struct frame {
+	  node_type node;
+	  node_type parent;
+	  node_type* link;
+	  write_op* first;
+	  write_op* last;
+	};
+	std::vector<node_type> visited;
+	std::vector<node_type> erased;
+	std::vector<node_type> built;
+	std::vector<frame> frames = {{root_, nullptr, &root_, pending_writes_.data(), pending_writes_.data() + pending_writes_.size()}};
+	while (!frames.empty()) {
+	  frame current = frames.back();
+	  frames.pop_back();
+	  if (current.last - current.first == 1) {
+		merge_write(current.node, current.parent, current.link, current.first, visited, erased, built);
+		continue;
+	  }
+	  if (current.node == nullptr) {
+		size_type count = std::count_if(current.first, current.last, [](const write_op& op) { return op.value.has_value(); });
+		*current.link = build_writes(current.first, count, current.parent);
+		size_ += count;
+		if (count != 0) {
+		  built.push_back(deepest_built(*current.link, count));
+		}
+		continue;
+	  }
+	  const key_type& key = key_of(current.node->data);
+	  write_op* middle = std::lower_bound(current.first, current.last, key, [this](const write_op& op, const key_type& k) {
+		return compare_(op.key, k);
+	  });
+	  write_op* right = middle;
+	  if (middle != current.last && !compare_(key, middle->key)) {
+		merge_existing(current.node, *middle, erased);
+		++right;
+	  }
+	  if constexpr (!std::is_void_v<Augment>) {
+		visited.push_back(current.node);
+	  }
+	  if (right != current.last) {
+		frames.push_back({current.node->right, current.node, &current.node->right, right, current.last});
+	  }
+	  if (current.first != middle) {
+		frames.push_back({current.node->left, current.node, &current.node->left, current.first, middle});
+	  }
+	}
+	for (auto it = visited.rbegin(); it != visited.rend(); ++it) {
+	  update_summary(*it);
+	}
+	for (node_type node : erased) {
+	  remove_node(node);
+	}
+	for (node_type node : built) {
+	  restore_balance(node);
+	}
+  }
+
+  void merge_existing(node_type node, write_op& op, std::vector<node_type>& erased) {
+	if (!op.value) {
+	  erased.push_back(node);
+	} else if constexpr (!std::is_void_v<Mapped>) {
+	  if (op.overwrite) {
+		node->data.second = std::move(op.value->second);
+	  }
+	}
+  }
+
+  // Once a single operation is left for a subtree, a plain descent is cheaper than splitting ranges.
+  void merge_write(node_type node, node_type parent, node_type* link, write_op* op,
+				   std::vector<node_type>& visited, std::vector<node_type>& erased, std::vector<node_type>& built) {
+	while (node != nullptr) {
+	  if (compare_(op->key, key_of(node->data))) {
+		link = &node->left;
+	  } else if (compare_(key_of(node->data), op->key)) {
+		link = &node->right;
 	  } else {
+		merge_existing(node, *op, erased);
+		if constexpr (!std::is_void_v<Augment>) {
+		  visited.push_back(node);
+		}
+		return;
+	  }
+	  if constexpr (!std::is_void_v<Augment>) {
+		visited.push_back(node);
+	  }
+	  parent = node;
+	  node = *link;
+	}
+	if (op->value) {
+	  *link = build_writes(op, 1, parent);
+	  ++size_;
+	  built.push_back(*link);
+	}
+  }
+
+  node_type build_writes(write_op*& first, size_type count, node_type parent) {
+	if (count == 0) {
+	  return nullptr;
+	}
+	size_type left_count = count / 2;
+	node_type left = build_writes(first, left_count, nullptr);
+	while (!first->value) {
+	  ++first;
+	}
+	node_type new_node = alloc_traits::allocate(allocator_, 1);
+	alloc_traits::construct(allocator_, new_node, std::in_place, std::move(*first->value));
+	++first;
+	new_node->parent = parent;
+	new_node->left = left;
+	refresh_prefix(new_node);
+	if (left) {
+	  left->parent = new_node;
+	  refresh_prefix(left);
+	}
+	new_node->right = build_writes(first, count - left_count - 1, new_node);
+	update_summary(new_node);
+	return new_node;
+  }
+
+  // The finger is the maximum when nothing bounds it from above, which keeps repeated appends O(1).
+  node_type max_node_hint() const {
+	if (!finger_.empty() && !finger_.back().node->right && !finger_.back().upper) {
+	  return finger_.back().node;
+	}
+	return root_ ? root_->get_max_node() : nullptr;
+  }
+
+  template <typename ForwardIt>
+  node_type build_sorted(ForwardIt& first, ForwardIt last, size_type count, node_type parent) {
+	if (count == 0) {
+	  return nullptr;
+	}
+	size_type left_count = count / 2;
+	node_type left = build_sorted(first, last, left_count, nullptr);
+	node_type new_node = alloc_traits::allocate(allocator_, 1);
+	alloc_traits::construct(allocator_, new_node, *first);
+	for (++first; first != last && !compare_(key_of(new_node->data), key_of(*first)); ++first) {}
+	new_node->parent = parent;
+	new_node->left = left;
+	refresh_prefix(new_node);
+	if (left) {
+	  left->parent = new_node;
+	  refresh_prefix(left);
+	}
+	new_node->right = build_sorted(first, last, count - left_count - 1, new_node);
+	update_summary(new_node);
+	return new_node;
+  }
+
+  void replace_child(node_type parent, node_type old_child, node_type new_child) {
+	if (parent == nullptr) {
+	  root_ = new_child;
+	} else if (parent->left == old_child) {
+	  parent->left = new_child;
+	} else {
+	  parent->right = new_child;
+	}
+	if (new_child) {
+	  new_child->parent = parent;
+	  refresh_prefix(new_child);
+	}
+  }
+
+  // Relinks instead of copying the successor's value, so other nodes (and iterators to them) stay valid.
+  void remove_node(node_type node) {
+	finger_.clear();
+	bool repair_cursor = compaction_.active && !compaction_.van_emde_boas && compaction_.cursor == node;
+	if (repair_cursor) {
+	  compaction_.cursor = successor(node, compaction_.order);
+	}
+	node_type changed = node->parent;
+	node_type replacement = node->left ? node->left : node->right;
+	if (node->left == nullptr) {
+	  replace_child(node->parent, node, node->right);
+	} else if (node->right == nullptr) {
+	  replace_child(node->parent, node, node->left);
+	} else {
+	  node_type successor = node->right->get_min_node();
+	  changed = successor;
+	  replacement = successor;
+	  retarget_plan(successor, successor->right);
+	  if (successor->parent != node) {
+		changed = successor->parent;
+		replace_child(successor->parent, successor, successor->right);
+		successor->right = node->right;
+		successor->right->parent = successor;
+		refresh_prefix(successor->right);
+	  }
+	  replace_child(node->parent, node, successor);
+	  successor->left = node->left;
+	  successor->left->parent = successor;
+	  refresh_prefix(successor->left);
+	}
+	update_path(changed);
+	retarget_plan(node, replacement);
+	// In pre-order the node now in the erased one's place comes next; in the other orders, whatever
+	// followed the erased node still does.
+	if (repair_cursor && compaction_.order == TraversalType::PreOrder && replacement) {
+	  compaction_.cursor = replacement;
+	}
+	free_node(node);
+	--size_;
+	if constexpr (self_balancing) {
+	  if (3 * size_ < 2 * peak_size_) {
+		rebuild(root_, size_);
+	  }
+	}
+  }
+
+  // Nodes living in a compaction block are only destroyed; the block goes once its last node does.
+  void free_node(node_type node) {
+	alloc_traits::destroy(allocator_, node);
+	if (compaction_.active && compaction_.block.contains(node)) {
+	  --compaction_.block.live;
+	  --compaction_.moved;
+	  return;
+	}
+	auto block = block_of(blocks_, node);
+	if (block == blocks_.end()) {
+	  alloc_traits::deallocate(allocator_, node, 1);
+	  return;
+	}
+	if (compaction_.active && block->pass == compaction_.pass) {
+	  --compaction_.moved;
+	}
+	if (--block->live == 0) {
+	  alloc_traits::deallocate(allocator_, block->nodes, block->capacity);
+	  blocks_.erase(block);
+	}
+  }
+
+  // blocks is kept sorted by address.
+  static typename std::vector<node_block>::iterator block_of(std::vector<node_block>& blocks, node_type node) {
+	auto after = std::upper_bound(blocks.begin(), blocks.end(), node, [](node_type lhs, const node_block& rhs) {
+	  return std::less<node_type>()(lhs, rhs.nodes);
+	});
+	return after != blocks.begin() && std::prev(after)->contains(node) ? std::prev(after) : blocks.end();
+  }
+
+  static void add_block(std::vector<node_block>& blocks, const node_block& block) {
+	auto after = std::upper_bound(blocks.begin(), blocks.end(), block.nodes, [](node_type lhs, const node_block& rhs) {
+	  return std::less<node_type>()(lhs, rhs.nodes);
+	});
+	blocks.insert(after, block);
+  }
+
+  static constexpr size_type compaction_segment = 1 << 12;
+
+  void open_compaction() {
+	flush();
+	finish_compaction();
+	compaction_.active = true;
+	++compaction_.pass;
+	compaction_.moved = 0;
+	compaction_.block = {nullptr, 0, 0, 0, compaction_.pass};
+  }
+
+  void seal_segment() {
+	node_block& block = compaction_.block;
+	if (block.nodes == nullptr) {
+	  return;
+	}
+	if (block.live == 0) {
+	  alloc_traits::deallocate(allocator_, block.nodes, block.capacity);
+	} else {
+	  add_block(blocks_, block);
+	}
+	block = {nullptr, 0, 0, 0, compaction_.pass};
+  }
+
+  void finish_compaction() {
+	if (!compaction_.active) {
+	  return;
+	}
+	compaction_.active = false;
+	compaction_.plan.clear();
+	seal_segment();
+  }
+
+  bool moved_in_pass(node_type node) {
+	if (compaction_.block.contains(node)) {
+	  return true;
+	}
+	auto block = block_of(blocks_, node);
+	return block != blocks_.end() && block->pass == compaction_.pass;
+  }
+
+  // Next node of the layout that has not been moved in this pass yet.
+  node_type next_to_compact() {
+	if (compaction_.van_emde_boas) {
+	  node_type next = next_in_layout();
+	  while (next != nullptr && moved_in_pass(next)) {
+		next = next_in_layout();
+	  }
+	  return next;
+	}
+	node_type next = compaction_.cursor;
+	while (next != nullptr && moved_in_pass(next)) {
+	  next = successor(next, compaction_.order);
+	}
+	compaction_.cursor = next ? successor(next, compaction_.order) : nullptr;
+	return next;
+  }
+
+  // Nominal height of a fresh layout: a balanced tree's. Deeper nodes start new layouts below it.
+  size_type layout_height() const {
+	return std::bit_width(size_);
+  }
+
+  // Unfolds the recursive layout, which lays out the top half of the levels and then each subtree
+  // hanging below it, one piece at a time. A piece costs O(1), and the next node is at most O(height)
+  // pieces away.
+  node_type next_in_layout() {
+	std::vector<layout_task>& plan = compaction_.plan;
+	while (!plan.empty()) {
+	  layout_task task = plan.back();
+	  plan.pop_back();
+	  node_type node = task.node;
+	  if (task.depth > 0) {
+		push_layout(node->right, task.depth - 1, task.height, task.bottom);
+		push_layout(node->left, task.depth - 1, task.height, task.bottom);
+	  } else if (task.height == 1) {
+		if (task.bottom) {
+		  push_layout(node->right, 0, layout_height(), true);
+		  push_layout(node->left, 0, layout_height(), true);
+		}
+		return node;
+	  } else {
+		size_type top_height = task.height / 2;
+		plan.push_back({node, top_height, task.height - top_height, task.bottom});
+		plan.push_back({node, 0, top_height, false});
+	  }
+	}
+	return nullptr;
+  }
+
+  void push_layout(node_type node, size_type depth, size_type height, bool bottom) {
+	if (node) {
+	  compaction_.plan.push_back({node, depth, height, bottom});
+	}
+  }
+
+  // The pending layout refers to at most O(height) nodes, so patching it is as cheap as a descent.
+  void retarget_plan(node_type from, node_type to) {
+	for (layout_task& task : compaction_.plan) {
+	  if (task.node == from) {
+		task.node = to;
+	  }
+	}
+	if (to == nullptr) {
+	  std::erase_if(compaction_.plan, [](const layout_task& task) { return task.node == nullptr; });
+	}
+  }
+
+  node_type first_in(TraversalType order) const {
+	if (root_ == nullptr) {
+	  return nullptr;
+	}
+	switch (order) {
+	  case TraversalType::InOrder:
+		return root_->get_min_node();
+	  case TraversalType::PreOrder:
+		return root_;
+	  case TraversalType::PostOrder:
+		return root_->get_min_leaf();
+	}
+	return nullptr;
+  }
+
+  node_type successor(node_type node, TraversalType order) const {
+	iterator it(root_, node, order);
+	++it;
+	return it.current_;
+  }
+
+  void relocate(node_type node, node_block& block) {
+	node_type slot = block.nodes + block.used++;
+	alloc_traits::construct(allocator_, slot, std::in_place, std::move(node->data));
+	slot->summary = node->summary;
+	slot->prefix = node->prefix;
+	slot->left = node->left;
+	slot->right = node->right;
+	replace_child(node->parent, node, slot);
+	if (slot->left) {
+	  slot->left->parent = slot;
+	}
+	if (slot->right) {
+	  slot->right->parent = slot;
+	}
+	finger_.clear();
+	retarget_plan(node, slot);
+	++block.live;
+	++compaction_.moved;
+	free_node(node);
+  }
+
+  // Smaller trees are not worth starting threads for.
+  static constexpr size_type parallel_threshold = 1 << 14;
+
+  std::vector<traversal_chunk> split_traversal(TraversalType type, unsigned threads) const {
+	std::vector<traversal_chunk> chunks;
+	size_type depth = 0;
+	if (threads > 1 && size_ >= parallel_threshold) {
+	  // About eight subtrees per thread, so threads that draw small subtrees pick up more of them.
+	  while ((size_type(1) << depth) < size_type(threads) * 8) {
+		++depth;
+	  }
+	}
+	split_traversal(root_, type, depth, chunks);
+	return chunks;
+  }
+
+  static void split_traversal(node_type node, TraversalType type, size_type depth, std::vector<traversal_chunk>& chunks) {
+	if (node == nullptr) {
+	  return;
+	}
+	if (depth == 0) {
+	  chunks.push_back({node, true});
+	  return;
+	}
+	if (type == TraversalType::PreOrder) {
+	  chunks.push_back({node, false});
+	}
+	split_traversal(node->left, type, depth - 1, chunks);
+	if (type == TraversalType::InOrder) {
+	  chunks.push_back({node, false});
+	}
+	split_traversal(node->right, type, depth - 1, chunks);
+	if (type == TraversalType::PostOrder) {
+	  chunks.push_back({node, false});
+	}
+  }
+
+  // One chunk's result, written once by the worker that walked the chunk. Each slot has cache lines
+  // of its own, so neighbouring workers do not contend for them, and T = bool gets no vector<bool>.
+  template <typename T>
+  struct alignas(64) chunk_result {
+	std::optional<T> value;
+  };
+
+  static node_type first_in_chunk(const traversal_chunk& chunk, TraversalType type) {
+	if (!chunk.subtree || type == TraversalType::PreOrder) {
+	  return chunk.node;
+	}
+	return type == TraversalType::InOrder ? chunk.node->get_min_node() : chunk.node->get_min_leaf();
+  }
+
+  // Runs task(0) .. task(count - 1) on the calling thread and up to threads - 1 pool helpers, each
+  // taking the next unclaimed index, so threads that finish early pick up the remaining chunks.
+  template <typename Task>
+  static void run_parallel(size_type count, unsigned threads, Task task) {
+	size_type workers = std::min<size_type>(std::max(threads, 1u), count);
+	if (workers == 0) {
+	  return;
+	}
+	std::atomic<size_type> next = 0;
+	std::mutex error_mutex;
+	std::exception_ptr error;
+	std::function<void()> work = [&] {
+	  try {
+		for (size_type i = next++; i < count; i = next++) {
+		  task(i);
+		}
+	  } catch (...) {
+		std::lock_guard<std::mutex> lock(error_mutex);
+		if (!error) {
+		  error = std::current_exception();
+		}
+		next = count;
+	  }
+	};
+	parallel_workers::run(workers - 1, work);
+	if (error) {
+	  std::rethrow_exception(error);
+	}
+  }
+
+  template <typename Fn>
+  static void visit_chunk(const traversal_chunk& chunk, TraversalType type, Fn&& fn) {
+	node_type top = chunk.node;
+	if (!chunk.subtree) {
+	  fn(std::as_const(top->data));
+	  return;
+	}
+	switch (type) {
+	  case TraversalType::InOrder:
+		for (node_type node = top->get_min_node(); node != nullptr;) {
+		  fn(std::as_const(node->data));
+		  if (node->right) {
+			node = node->right->get_min_node();
+			continue;
+		  }
+		  while (node != top && node->parent->right == node) {
+			node = node->parent;
+		  }
+		  node = node == top ? nullptr : node->parent;
+		}
+		break;
+	  case TraversalType::PreOrder:
+		for (node_type node = top; node != nullptr;) {
+		  fn(std::as_const(node->data));
+		  if (node->left || node->right) {
+			node = node->left ? node->left : node->right;
+			continue;
+		  }
+		  while (node != top && (node->parent->right == node || !node->parent->right)) {
+			node = node->parent;
+		  }
+		  node = node == top ? nullptr : node->parent->right;
+		}
+		break;
+	  case TraversalType::PostOrder:
+		for (node_type node = top->get_min_leaf(); node != nullptr;) {
+		  fn(std::as_const(node->data));
+		  if (node == top) {
+			break;
+		  }
+		  node_type parent = node->parent;
+		  node = node == parent->left && parent->right ? parent->right->get_min_leaf() : parent;
+		}
+		break;
+	}
+  }
+
+  // Augmented trees are kept balanced, since every summary update and query walks a whole path.
+  // Scapegoat rule with alpha = 2/3: once a node is linked deeper than log_{3/2}(size), the lowest
+  // ancestor lying more than log_{3/2} of its own subtree size above that node is rebuilt perfectly
+  // balanced; erasures rebuild the whole tree once size drops below 2/3 of its peak. Nodes are
+  // relinked, never copied, so iterators stay valid.
+  static constexpr bool self_balancing = !std::is_void_v<Augment>;
+
+  void restore_balance(node_type node) {
+	if constexpr (self_balancing) {
+	  peak_size_ = std::max(peak_size_, size_);
+	  size_type depth = 0;
+	  for (node_type up = node->parent; up != nullptr; up = up->parent) {
+		++depth;
+	  }
+	  double limit = 1;
+	  for (size_type level = 0; level < depth; ++level) {
+		limit *= 1.5;
+	  }
+	  if (limit <= size_) {
+		return;
+	  }
+	  size_type count = subtree_size(node);
+	  double reach = 1;
+	  for (node_type child = node, parent = node->parent; parent != nullptr; child = parent, parent = parent->parent) {
+		count += 1 + subtree_size(parent->left == child ? parent->right : parent->left);
+		reach *= 1.5;
+		if (reach > count) {
+		  rebuild(parent, count);
+		  return;
+		}
+	  }
+	}
+  }
+
+  static size_type subtree_size(node_type node) {
+	size_type count = 0;
+	if (node) {
+	  visit_chunk({node, true}, TraversalType::PreOrder, [&count](const_reference) { ++count; });
+	}
+	return count;
+  }
+
+  // Only a rebuild of the whole tree restarts the peak; a partial one leaves other paths as deep.
+  void rebuild(node_type top, size_type count) {
+	if (top == root_) {
+	  peak_size_ = size_;
+	}
+	finger_.clear();
+	if (top == nullptr) {
+	  return;
+	}
+	std::vector<node_type> nodes;
+	nodes.reserve(count);
+	for (node_type node = top->get_min_node(); node != nullptr;) {
+	  nodes.push_back(node);
+	  if (node->right) {
+		node = node->right->get_min_node();
+		continue;
+	  }
+	  while (node != top && node->parent->right == node) {
+		node = node->parent;
+	  }
+	  node = node == top ? nullptr : node->parent;
+	}
+	node_type parent = top->parent;
+	node_type subtree = link_balanced(nodes.data(), nodes.size(), parent);
+	if (parent == nullptr) {
+	  root_ = subtree;
+	} else if (parent->left == top) {
+	  parent->left = subtree;
+	} else {
+	  parent->right = subtree;
+	}
+  }
+
+  node_type link_balanced(node_type* nodes, size_type count, node_type parent) {
+	if (count == 0) {
+	  return nullptr;
+	}
+	size_type left_count = count / 2;
+	node_type node = nodes[left_count];
+	node->parent = parent;
+	refresh_prefix(node);
+	node->left = link_balanced(nodes, left_count, node);
+	node->right = link_balanced(nodes + left_count + 1, count - left_count - 1, node);
+	update_summary(node);
+	return node;
+  }
+
+  // Deepest node of a subtree that build_sorted or build_writes linked from count values.
+  static node_type deepest_built(node_type node, size_type count) {
+	while (count > 1) {
+	  size_type left_count = count / 2;
+	  size_type right_count = count - left_count - 1;
+	  node = left_count > right_count ? node->left : node->right;
+	  count = std::max(left_count, right_count);
+	}
+	return node;
+  }
+
+  void update_summary(node_type node) {
+	if constexpr (!std::is_void_v<Augment>) {
+	  Augment augment;
+	  node->summary = augment.project(node->data);
+	  if (node->left) {
+		node->summary = augment.combine(node->left->summary, node->summary);
+	  }
+	  if (node->right) {
+		node->summary = augment.combine(node->summary, node->right->summary);
+	  }
+	}
+  }
+
+  static summary_type summary_of(node_type node) {
+	return node ? node->summary : Augment::identity();
+  }
+
+  // Recomputes summaries from node up to the root after a structural change below it.
+  void update_path(node_type node) {
+	if constexpr (!std::is_void_v<Augment>) {
+	  for (; node != nullptr; node = node->parent) {
+		update_summary(node);
+	  }
+	}
+  }
+
+  template <typename T>
+  static bool overlaps(node_type node, const T& lo, const T& hi) {
+	return !(node->data.second < lo) && !(hi < node->data.first);
+  }
+
+  // Leftmost interval in the subtree overlapping [lo, hi]. If the left subtree reaches lo but holds
+  // no overlap, its widest interval already starts after hi, and so does everything to the right.
+  template <typename T>
+  static node_type first_overlap(node_type node, const T& lo, const T& hi) {
+	while (node != nullptr && !(node->summary < lo)) {
+	  if (node->left && !(node->left->summary < lo)) {
+		node = node->left;
+	  } else if (overlaps(node, lo, hi)) {
+		return node;
+	  } else if (hi < node->data.first) {
+		return nullptr;
+	  } else {
+		node = node->right;
+	  }
+	}
+	return nullptr;
+  }
+
+  template <typename T>
+  static node_type next_overlap(node_type node, const T& lo, const T& hi) {
+	if (node_type found = first_overlap(node->right, lo, hi)) {
+	  return found;
+	}
+	while (node->parent) {
+	  node_type parent = node->parent;
+	  if (parent->left == node) {
+		if (hi < parent->data.first) {
+		  return nullptr;
+		}
+		if (overlaps(parent, lo, hi)) {
+		  return parent;
+		}
+		if (node_type found = first_overlap(parent->right, lo, hi)) {
+		  return found;
+		}
+	  }
+	  node = parent;
+	}
+	return nullptr;
+  }
+
+  node_type find_node(const key_type& key, node_type current_node) const {
+	key_search search(*this, key);
+	while (current_node != nullptr) {
+	  int order = search(current_node);
+	  if (order < 0) {
+		current_node = current_node->left;
+	  } else if (order > 0) {
 		current_node = current_node->right;
+	  } else {
+		break;
 	  }
 	}
 	return current_node;
   }
 
+  // Compares one key against the nodes of a path descending from the root, one call per node.
+  class key_search {
+   public:
+	key_search(const bst& tree, const key_type& key)
+		: tree_(tree)
+		, key_(key)
+		, prefix_(key)
+	{}
+
+	int operator()(node_type node) {
+	  if constexpr (key_cache::enabled) {
+		return prefix_(key_of(node->data), node->prefix);
+	  } else {
+		return tree_.compare_(key_, key_of(node->data)) ? -1 : (tree_.compare_(key_of(node->data), key_) ? 1 : 0);
+	  }
+	}
+
+	bool less(node_type node) {
+	  if constexpr (key_cache::enabled) {
+		return (*this)(node) < 0;
+	  } else {
+		return tree_.compare_(key_, key_of(node->data));
+	  }
+	}
+
+	bool less_equal(node_type node) {
+	  if constexpr (key_cache::enabled) {
+		return (*this)(node) <= 0;
+	  } else {
+		return !tree_.compare_(key_of(node->data), key_);
+	  }
+	}
+
+   private:
+	const bst& tree_;
+	const key_type& key_;
+	[[no_unique_address]] typename key_cache::search prefix_;
+  };
+
+  void refresh_prefix(node_type node) {
+	if constexpr (key_cache::enabled) {
+	  node->prefix = key_cache::make(key_of(node->data), node->parent ? &key_of(node->parent->data) : nullptr);
+	}
+  }
+
+  // Iterative, walking the source and the copy in step, so degenerate trees copy without recursion.
   node_type copy(node_type src, node_type parent, auto Alloc) {
 	if (!src) {
 	  return nullptr;
 	}
+	auto clone = [&Alloc](node_type from, node_type to_parent) {
+	  node_type new_node = alloc_traits::allocate(Alloc, 1);
+	  alloc_traits::construct(Alloc, new_node, from->data);
+	  new_node->parent = to_parent;
+	  new_node->summary = from->summary;
+	  new_node->prefix = from->prefix;
+	  return new_node;
+	};
+
+	node_type root = clone(src, parent);
+	node_type from = src;
+	node_type to = root;
+	while (true) {
+	  if (from->left && !to->left) {
+		to->left = clone(from->left, to);
+		from = from->left;
+		to = to->left;
+	  } else if (from->right && !to->right) {
+		to->right = clone(from->right, to);
+		from = from->right;
+		to = to->right;
+	  } else if (from == src) {
+		break;
+	  } else {
+		from = from->parent;
+		to = to->parent;
+	  }
+	}
+	return root;
+  }
 
-	node_type new_node = alloc_traits::allocate(Alloc, 1);
-	alloc_traits::construct(Alloc, new_node, src->data);
-	new_node->parent = parent;
-	new_node->left = copy(src->left, new_node, Alloc);
-	new_node->right = copy(src->right, new_node, Alloc);
-	return new_node;
+  // Iterative, so a degenerate tree cannot overflow the stack while it is torn down.
+  static size_type release(std::vector<node_type>& pending, std::vector<node_block>& blocks,
+						   allocator_type& allocator, size_type budget) {
+	std::sort(blocks.begin(), blocks.end(), [](const node_block& lhs, const node_block& rhs) {
+	  return std::less<node_type>()(lhs.nodes, rhs.nodes);
+	});
+	size_type released = 0;
+	while (released < budget && !pending.empty()) {
+	  node_type node = pending.back();
+	  pending.pop_back();
+	  if (node->left) {
+		pending.push_back(node->left);
+	  }
+	  if (node->right) {
+		pending.push_back(node->right);
+	  }
+	  alloc_traits::destroy(allocator, node);
+	  if (block_of(blocks, node) == blocks.end()) {
+		alloc_traits::deallocate(allocator, node, 1);
+	  }
+	  ++released;
+	}
+	if (pending.empty()) {
+	  for (const node_block& block : blocks) {
+		alloc_traits::deallocate(allocator, block.nodes, block.capacity);
+	  }
+	  blocks.clear();
+	}
+	return released;
   }
 
-  void clear(node_type& root) {
-	if (root) {
-	  clear(root->left);
-	  clear(root->right);
-	  alloc_traits::destroy(allocator_, root);
-	  alloc_traits::deallocate(allocator_, root, 1);
-	  root = nullptr;
+  static constexpr size_type background_threshold = 1 << 12;
+
+  // Never throws, as the destructor calls it: if the job cannot be built or queued, the nodes are
+  // freed here instead.
+  void retire_in_background() noexcept {
+	if (retired_.empty() && retired_blocks_.empty()) {
+	  return;
+	}
+	bool posted = false;
+	try {
+	  posted = background_reclaimer::post(
+		  [pending = retired_, blocks = retired_blocks_, allocator = allocator_]() mutable {
+			release(pending, blocks, allocator, std::numeric_limits<size_type>::max());
+		  });
+	} catch (...) {
+	}
+	if (posted) {
+	  retired_.clear();
+	  retired_blocks_.clear();
+	} else {
+	  reclaim(std::numeric_limits<size_type>::max());
 	}
   }
   node_type root_;
   size_type size_;
+  size_type peak_size_;
+  std::vector<finger_entry> finger_;
+  ReclaimMode reclaim_mode_;
+  size_type write_buffer_limit_;
   key_compare compare_;
   allocator_type allocator_;
+  std::vector<node_type> retired_;
+  std::vector<node_block> retired_blocks_;
+  std::vector<node_block> blocks_;
+  compaction_state compaction_;
+  std::vector<write_op> pending_writes_;
+  std::vector<write_op> write_tail_;
 };
+
+template <typename Key, typename T, typename Compare = std::less<Key>, typename Allocator = std::allocator<std::pair<const Key, T>>>
+using bst_map = bst<Key, Compare, Allocator, T>;
+
+template <typename T, typename Allocator = std::allocator<std::pair<T, T>>>
+using interval_bst = bst<std::pair<T, T>, std::less<std::pair<T, T>>, Allocator, void, interval_augment<T>>;
+
+template <typename Key, typename Monoid, typename Projection = std::identity, typename Compare = std::less<Key>, typename Allocator = std::allocator<Key>>
+using aggregate_bst = bst<Key, Compare, Allocator, void, monoid_augment<Monoid, Projection>>;
@@ -0,0 +1,242 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+
+
+// Search tree over a fixed set of keys, built entirely at compile time: the keys are sorted,
+// deduplicated and laid out in Eytzinger (breadth-first) order, where the children of slot i are
+// slots 2i + 1 and 2i + 2. Lookups are a branch-free descent over one contiguous array and need no
+// heap. Key must be usable in constant expressions, e.g. integers, enums or std::string_view.
+template <typename Key, std::size_t N, typename Compare = std::less<Key>>
+class static_bst {
+ public:
+  using key_type = Key;
+  using value_type = Key;
+  using key_compare = Compare;
+  using value_compare = Compare;
+  using size_type = std::size_t;
+  using reference = const value_type&;
+  using const_reference = const value_type&;
+  using pointer = const value_type*;
+  using const_pointer = const value_type*;
+
+  // Walks the keys in ascending order. Holds the slot index; size() marks the end.
+  class const_iterator {
+   public:
+	using iterator_category = std::bidirectional_iterator_tag;
+	using value_type = Key;
+	using difference_type = std::ptrdiff_t;
+	using pointer = const Key*;
+	using reference = const Key&;
+
+	constexpr const_iterator()
+		: tree_(nullptr)
+		, index_(0)
+	{}
+
+	constexpr const_iterator(const static_bst* tree, size_type index)
+		: tree_(tree)
+		, index_(index)
+	{}
+
+	constexpr reference operator*() const {
+	  return tree_->keys_[index_];
+	}
+
+	constexpr pointer operator->() const {
+	  return &tree_->keys_[index_];
+	}
+
+	constexpr const_iterator& operator++() {
+	  index_ = tree_->next(index_);
+	  return *this;
+	}
+
+	constexpr const_iterator operator++(int) {
+	  const_iterator temp = *this;
+	  ++(*this);
+	  return temp;
+	}
+
+	constexpr const_iterator& operator--() {
+	  index_ = tree_->prev(index_);
+	  return *this;
+	}
+
+	constexpr const_iterator operator--(int) {
+	  const_iterator temp = *this;
+	  --(*this);
+	  return temp;
+	}
+
+	constexpr bool operator==(const const_iterator& other) const {
+	  return index_ == other.index_;
+	}
+
+	constexpr bool operator!=(const const_iterator& other) const {
+	  return index_ != other.index_;
+	}
+
+   private:
+	const static_bst* tree_;
+	size_type index_;
+  };
+
+  using iterator = const_iterator;
+  using reverse_iterator = std::reverse_iterator<const_iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  constexpr static_bst(const Key (&keys)[N], const Compare& compare = Compare())
+	  : keys_()
+	  , size_(0)
+	  , compare_(compare)
+  {
+	std::array<Key, N> sorted;
+	std::copy(keys, keys + N, sorted.begin());
+	std::sort(sorted.begin(), sorted.end(), compare_);
+	for (size_type i = 0; i < N; ++i) {
+	  if (size_ == 0 || compare_(sorted[size_ - 1], sorted[i])) {
+		sorted[size_++] = sorted[i];
+	  }
+	}
+	size_type taken = 0;
+	lay_out(sorted, 0, taken);
+  }
+
+  constexpr size_type size() const {
+	return size_;
+  }
+
+  constexpr bool empty() const {
+	return size_ == 0;
+  }
+
+  constexpr size_type max_size() const {
+	return N;
+  }
+
+  constexpr key_compare key_comp() const {
+	return compare_;
+  }
+
+  constexpr value_compare value_comp() const {
+	return compare_;
+  }
+
+  constexpr const_iterator begin() const {
+	return const_iterator(this, size_ == 0 ? size_ : leftmost(0));
+  }
+
+  constexpr const_iterator end() const {
+	return const_iterator(this, size_);
+  }
+
+  constexpr const_iterator cbegin() const {
+	return begin();
+  }
+
+  constexpr const_iterator cend() const {
+	return end();
+  }
+
+  constexpr const_reverse_iterator rbegin() const {
+	return const_reverse_iterator(end());
+  }
+
+  constexpr const_reverse_iterator rend() const {
+	return const_reverse_iterator(begin());
+  }
+
+  constexpr const_iterator lower_bound(const key_type& key) const {
+	return const_iterator(this, descend([&](const Key& slot) { return compare_(slot, key); }));
+  }
+
+  constexpr const_iterator upper_bound(const key_type& key) const {
+	return const_iterator(this, descend([&](const Key& slot) { return !compare_(key, slot); }));
+  }
+
+  constexpr const_iterator find(const key_type& key) const {
+	const_iterator found = lower_bound(key);
+	return found != end() && !compare_(key, *found) ? found : end();
+  }
+
+  constexpr bool contains(const key_type& key) const {
+	return find(key) != end();
+  }
+
+  constexpr size_type count(const key_type& key) const {
+	return contains(key) ? 1 : 0;
+  }
+
+ private:
+  // Fills the subtree rooted at slot `index` in order, so an in-order walk yields the sorted keys.
+  constexpr void lay_out(const std::array<Key, N>& sorted, size_type index, size_type& taken) {
+	if (index >= size_) {
+	  return;
+	}
+	lay_out(sorted, 2 * index + 1, taken);
+	keys_[index] = sorted[taken++];
+	lay_out(sorted, 2 * index + 2, taken);
+  }
+
+  // Descends right while goes_right(slot) holds and returns the last slot where it went left, i.e.
+  // the first key for which goes_right is false, or size() if there is none. Works on 1-based slot
+  // numbers, where the trailing one bits of the final position count the right turns to undo.
+  template <typename GoesRight>
+  constexpr size_type descend(GoesRight goes_right) const {
+	size_type position = 1;
+	while (position <= size_) {
+	  position = 2 * position + (goes_right(keys_[position - 1]) ? 1 : 0);
+	}
+	position >>= std::countr_one(position) + 1;
+	return position == 0 ? size_ : position - 1;
+  }
+
+  constexpr size_type leftmost(size_type index) const {
+	while (2 * index + 1 < size_) {
+	  index = 2 * index + 1;
+	}
+	return index;
+  }
+
+  constexpr size_type rightmost(size_type index) const {
+	while (2 * index + 2 < size_) {
+	  index = 2 * index + 2;
+	}
+	return index;
+  }
+
+  constexpr size_type next(size_type index) const {
+	if (2 * index + 2 < size_) {
+	  return leftmost(2 * index + 2);
+	}
+	while (index != 0 && index % 2 == 0) {
+	  index = (index - 1) / 2;
+	}
+	return index == 0 ? size_ : (index - 1) / 2;
+  }
+
+  constexpr size_type prev(size_type index) const {
+	if (index == size_) {
+	  return rightmost(0);
+	}
+	if (2 * index + 1 < size_) {
+	  return rightmost(2 * index + 1);
+	}
+	while (index != 0 && index % 2 == 1) {
+	  index = (index - 1) / 2;
+	}
+	return index == 0 ? size_ : (index - 1) / 2;
+  }
+
+  std::array<Key, N> keys_;
+  size_type size_;
+  [[no_unique_address]] Compare compare_;
+};
+
+template <typename Key, std::size_t N>
+static_bst(const Key (&)[N]) -> static_bst<Key, N>;
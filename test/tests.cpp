@@ -1,4 +1,5 @@
 #include <lib/bst.h>
+#include <lib/static_bst.h>
 #include <gtest/gtest.h>
 
 TEST(BinarySearchTreeTest, IsContainer) {
@@ -169,3 +170,412 @@ TEST(BinarySearchTreeTest, TraversalTests){
         --expected;
     }
 }
+
+
+TEST(BinarySearchTreeTest, MapUpdatesValuesInPlace) {
+    bst_map<int, std::string> map;
+    map[3] = "three";
+    map[1] = "one";
+    EXPECT_EQ(map.size(), 2);
+    EXPECT_EQ(map[3], "three");
+
+    auto [it, inserted] = map.try_emplace(1, "uno");
+    EXPECT_FALSE(inserted);
+    EXPECT_EQ(it->second, "one");
+
+    auto [it2, inserted2] = map.insert_or_assign(1, "uno");
+    EXPECT_FALSE(inserted2);
+    EXPECT_EQ(it2->second, "uno");
+    EXPECT_TRUE(map.insert_or_assign(2, "two").second);
+
+    for (auto i = map.begin(); i != map.end(); ++i) {
+        i->second += "!";
+    }
+    EXPECT_EQ(map.find(2)->second, "two!");
+    EXPECT_EQ(map.begin()->first, 1);
+    const bst_map<int, std::string>& view = map;
+    EXPECT_TRUE(std::is_const<std::remove_reference<decltype((view.find(2)->second))>::type>::value);
+    EXPECT_TRUE(std::is_const<std::remove_reference<decltype((view.begin()->second))>::type>::value);
+    EXPECT_EQ(map.size(), 3);
+
+    map.erase(1);
+    EXPECT_FALSE(map.contains(1));
+    EXPECT_EQ(map.begin()->second, "two!");
+}
+
+TEST(BinarySearchTreeTest, IntervalOverlapQueries) {
+    interval_bst<int> intervals = {{15, 20}, {10, 30}, {17, 19}, {5, 20}, {12, 15}, {30, 40}};
+    std::vector<std::pair<int, int>> expected = {{10, 30}, {12, 15}, {15, 20}};
+
+    std::vector<std::pair<int, int>> found;
+    for (const auto& interval : intervals.overlapping(14, 16)) {
+        found.push_back(interval);
+    }
+    EXPECT_EQ(found, (std::vector<std::pair<int, int>>{{5, 20}, {10, 30}, {12, 15}, {15, 20}}));
+
+    intervals.erase({5, 20});
+    found.clear();
+    for (const auto& interval : intervals.overlapping(14, 16)) {
+        found.push_back(interval);
+    }
+    EXPECT_EQ(found, expected);
+
+    EXPECT_TRUE(intervals.any_overlap(35, 50));
+    EXPECT_FALSE(intervals.any_overlap(41, 50));
+    intervals.erase({30, 40});
+    EXPECT_FALSE(intervals.any_overlap(31, 50));
+
+    interval_bst<int> timeline;
+    for (int i = 0; i < 20000; ++i) {
+        timeline.insert({i * 10, i * 10 + 25});
+    }
+    for (int i = 0; i < 20000; i += 2) {
+        timeline.erase({i * 10, i * 10 + 25});
+    }
+    std::vector<std::pair<int, int>> hits;
+    for (const auto& interval : timeline.overlapping(100000, 100010)) {
+        hits.push_back(interval);
+    }
+    std::vector<std::pair<int, int>> expected_hits = {{99990, 100015}, {100010, 100035}};
+    EXPECT_EQ(hits, expected_hits);
+    EXPECT_FALSE(timeline.any_overlap(200016, 300000));
+}
+
+TEST(BinarySearchTreeTest, MonoidAggregationOverKeyRanges) {
+    struct bytes {
+        int operator()(const std::pair<const int, int>& entry) const {
+            return entry.second;
+        }
+    };
+    bst<int, std::less<int>, std::allocator<std::pair<const int, int>>, int, monoid_augment<sum_monoid<int>, bytes>> sizes;
+    sizes.insert({4, 400});
+    sizes.insert({1, 100});
+    sizes.insert({7, 700});
+    sizes.insert({3, 300});
+    sizes.insert({9, 900});
+    EXPECT_EQ(sizes.aggregate(1, 8), 1500);
+    EXPECT_EQ(sizes.aggregate(2, 4), 300);
+    EXPECT_EQ(sizes.aggregate(5, 6), 0);
+
+    sizes.erase(4);
+    EXPECT_EQ(sizes.aggregate(1, 8), 1100);
+
+    aggregate_bst<int, min_monoid<int>> keys = {8, 3, 10, 1, 6, 14, 4, 7, 13};
+    EXPECT_EQ(keys.aggregate(5, 14), 6);
+    keys.erase(6);
+    EXPECT_EQ(keys.aggregate(5, 14), 7);
+    EXPECT_EQ(keys.aggregate(15, 20), std::numeric_limits<int>::max());
+}
+
+TEST(BinarySearchTreeTest, AppendsSortedStreams) {
+    bst<int> tree;
+    for (int i = 0; i < 100; i += 2) {
+        tree.insert(i);
+    }
+    tree.insert(51);
+    tree.insert(100);
+
+    std::vector<int> batch = {7, 100, 102, 102, 103, 110, 120};
+    tree.append_sorted(batch.begin(), batch.end());
+    EXPECT_EQ(tree.size(), 57);
+    EXPECT_TRUE(tree.contains(7));
+    EXPECT_TRUE(tree.contains(103));
+    EXPECT_EQ(*tree.rbegin(), 120);
+
+    tree.insert(121);
+    tree.erase(120);
+    tree.insert(115);
+    tree.insert(122);
+
+    int previous = -1;
+    size_t visited = 0;
+    for (auto i = tree.begin(); i != tree.end(); ++i) {
+        EXPECT_LT(previous, *i);
+        previous = *i;
+        ++visited;
+    }
+    EXPECT_EQ(visited, tree.size());
+    EXPECT_EQ(*tree.lower_bound(111), 115);
+
+    bst<int> nearly_sorted;
+    for (int i = 0; i < 300000; i += 4) {
+        nearly_sorted.insert(i + 1);
+        nearly_sorted.insert(i);
+        nearly_sorted.insert(i + 3);
+        nearly_sorted.insert(i + 2);
+    }
+    bst<int> copy = nearly_sorted;
+    EXPECT_EQ(copy.size(), 300000);
+    EXPECT_TRUE(copy == nearly_sorted);
+    EXPECT_EQ(*copy.lower_bound(150001), 150001);
+}
+
+// A stateful allocator, whose copies must not be used from two threads at once.
+inline int arena_allocations = 0;
+
+template <typename T>
+struct arena_allocator {
+    using value_type = T;
+
+    arena_allocator() = default;
+
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(std::size_t n) {
+        ++arena_allocations;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        --arena_allocations;
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    bool operator==(const arena_allocator& other) const {
+        return arena == other.arena;
+    }
+
+    int arena = 0;
+};
+
+TEST(BinarySearchTreeTest, DefersReclamation) {
+    bst<int> tree;
+    tree.set_reclaim_mode(ReclaimMode::Deferred);
+    for (int i = 0; i < 100; ++i) {
+        tree.insert(i);
+    }
+    tree.clear();
+    EXPECT_TRUE(tree.empty());
+    EXPECT_TRUE(tree.reclaim_pending());
+
+    tree.insert(7);
+    EXPECT_EQ(tree.size(), 1);
+    EXPECT_EQ(tree.reclaim(40), 40);
+    EXPECT_EQ(tree.reclaim(100), 60);
+    EXPECT_FALSE(tree.reclaim_pending());
+    EXPECT_EQ(*tree.begin(), 7);
+
+    bst<int> background = {5, 3, 8};
+    background.set_reclaim_mode(ReclaimMode::Background);
+    background.clear();
+    EXPECT_TRUE(background.empty());
+    EXPECT_FALSE(background.reclaim_pending());
+
+    for (int round = 0; round < 3; ++round) {
+        std::vector<int> keys;
+        for (int i = 0; i < 20000; ++i) {
+            keys.push_back(i);
+        }
+        background.append_sorted(keys.begin(), keys.end());
+        background.clear();
+        EXPECT_FALSE(background.reclaim_pending());
+    }
+    background_reclaimer::drain();
+
+    bst<int, std::less<int>, arena_allocator<int>> arena;
+    arena.set_reclaim_mode(ReclaimMode::Background);
+    for (int i = 0; i < 20000; ++i) {
+        arena.insert(i);
+    }
+    EXPECT_EQ(arena_allocations, 20000);
+    arena.clear();
+    EXPECT_EQ(arena_allocations, 0);
+}
+
+TEST(BinarySearchTreeTest, BuffersWrites) {
+    bst<int> tree = {10, 20, 30};
+    tree.set_write_buffer(8);
+    tree.insert(15);
+    tree.insert(25);
+    EXPECT_EQ(tree.erase(20), 1);
+    EXPECT_EQ(tree.erase(21), 0);
+    tree.insert(20);
+    tree.erase(10);
+
+    EXPECT_TRUE(tree.contains(15));
+    EXPECT_TRUE(tree.contains(20));
+    EXPECT_FALSE(tree.contains(10));
+    EXPECT_EQ(tree.count(25), 1);
+
+    const bst<int> snapshot = tree;
+    EXPECT_TRUE(snapshot.contains(25));
+    EXPECT_FALSE(snapshot.contains(10));
+    tree.flush();
+    EXPECT_EQ(tree.size(), 4);
+    std::vector<int> expected = {15, 20, 25, 30};
+    std::vector<int>::iterator next = expected.begin();
+    for (auto i = tree.begin(); i != tree.end(); ++i) {
+        EXPECT_EQ(*i, *next);
+        ++next;
+    }
+
+    for (int i = 100; i < 120; ++i) {
+        tree.insert(i);
+    }
+    tree.flush();
+    EXPECT_EQ(tree.size(), 24);
+    EXPECT_EQ(*tree.lower_bound(31), 100);
+
+    bst<int> wide;
+    wide.set_write_buffer(10000);
+    for (int i = 0; i < 2000; ++i) {
+        wide.insert((i * 7) % 2000);
+        if (i % 5 == 0) {
+            EXPECT_EQ(wide.erase((i * 7) % 2000), 1);
+        }
+    }
+    EXPECT_FALSE(wide.contains(0));
+    EXPECT_TRUE(wide.contains(1));
+    EXPECT_EQ(wide.erase(1), 1);
+    EXPECT_FALSE(wide.contains(1));
+    wide.insert(1);
+    wide.flush();
+    EXPECT_EQ(wide.size(), 1600);
+}
+
+TEST(BinarySearchTreeTest, CompactsNodes) {
+    bst<int> tree = {10, 5, 7, 0, 15, 12, 20};
+    tree.erase(7);
+    tree.insert(8);
+    tree.compact(TraversalType::PreOrder);
+
+    std::vector<int> pre = {10, 5, 0, 8, 15, 12, 20};
+    std::vector<int>::iterator expected = pre.begin();
+    const char* previous = nullptr;
+    for (auto i = tree.begin(TraversalType::PreOrder); i != tree.end(TraversalType::PreOrder); ++i) {
+        EXPECT_EQ(*i, *expected);
+        const char* current = reinterpret_cast<const char*>(&*i);
+        if (previous) {
+            EXPECT_EQ(current - previous, sizeof(bst<int>::node));
+        }
+        previous = current;
+        ++expected;
+    }
+
+    tree.start_compaction();
+    EXPECT_FALSE(tree.compact_step(3));
+    tree.insert(30);
+    tree.erase(0);
+    EXPECT_TRUE(tree.compact_step(10));
+    EXPECT_EQ(tree.size(), 7);
+    EXPECT_EQ(*tree.begin(), 5);
+    EXPECT_EQ(*tree.rbegin(), 30);
+
+    tree.compact_van_emde_boas();
+    EXPECT_TRUE(tree.contains(12));
+    EXPECT_EQ(*tree.lower_bound(13), 15);
+
+    bst<int> large;
+    for (int i = 0; i < 10000; ++i) {
+        large.insert((i * 7919) % 10000);
+    }
+    large.start_compaction();
+    EXPECT_FALSE(large.compact_step(10));
+    large.erase(10);
+    while (!large.compact_step(1000)) {
+    }
+    previous = nullptr;
+    size_t adjacent = 0;
+    for (auto i = large.begin(); i != large.end(); ++i) {
+        const char* current = reinterpret_cast<const char*>(&*i);
+        adjacent += previous && current - previous == sizeof(bst<int>::node);
+        previous = current;
+    }
+    EXPECT_GE(adjacent, 9998 - 2);
+
+    large.start_van_emde_boas_compaction();
+    for (int i = 0; !large.compact_step(100); ++i) {
+        large.erase(i * 13 % 10000);
+    }
+    EXPECT_TRUE(large.contains(9999));
+    EXPECT_FALSE(large.contains(13));
+}
+
+TEST(BinarySearchTreeTest, SearchesStringKeysWithSharedPrefixes) {
+    static_assert(sizeof(bst<std::string>::node) < sizeof(bst<std::string, prefix_less>::node));
+    bst<std::string, prefix_less> tree = {"https://example.com/b", "https://example.com/a", "https://example.com/ab",
+                             "https://example.com", "https://example.org/", std::string("https://example.com/a\0b", 23), "a"};
+    EXPECT_TRUE(tree.contains("https://example.com/ab"));
+    EXPECT_TRUE(tree.contains(std::string("https://example.com/a\0b", 23)));
+    EXPECT_FALSE(tree.contains(std::string("https://example.com/a\0", 22)));
+    EXPECT_FALSE(tree.contains("https://example.com/"));
+    EXPECT_EQ(*tree.lower_bound("https://example.com/"), "https://example.com/a");
+    EXPECT_EQ(*tree.upper_bound("https://example.com/a"), std::string("https://example.com/a\0b", 23));
+    EXPECT_EQ(*tree.lower_bound("https://example.com/abc"), "https://example.com/b");
+
+    tree.erase("https://example.com/b");
+    tree.erase("https://example.com/a");
+    EXPECT_EQ(tree.size(), 5);
+    EXPECT_EQ(*tree.lower_bound("https://example.com/"), std::string("https://example.com/a\0b", 23));
+    EXPECT_EQ(*tree.upper_bound("https://example.com/ab"), "https://example.org/");
+}
+
+TEST(BinarySearchTreeTest, TraversesInParallel) {
+    bst<int> tree;
+    for (int i = 0; i < 40000; ++i) {
+        tree.insert((i * 7919) % 40000);
+    }
+
+    for (TraversalType type : {TraversalType::InOrder, TraversalType::PreOrder, TraversalType::PostOrder}) {
+        std::vector<int> expected;
+        for (auto i = tree.begin(type); i != tree.end(type); ++i) {
+            expected.push_back(*i);
+        }
+        std::vector<int> ordered = tree.parallel_reduce(type, std::vector<int>(), [](std::vector<int> lhs, std::vector<int> rhs) {
+            lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+            return lhs;
+        }, [](int value) { return std::vector<int>{value}; }, 4);
+        EXPECT_EQ(ordered, expected);
+    }
+
+    std::atomic<long long> sum = 0;
+    tree.parallel_for_each(TraversalType::PreOrder, [&sum](int value) { sum += value; }, 4);
+    EXPECT_EQ(sum, 40000LL * 39999 / 2);
+    EXPECT_EQ(tree.parallel_reduce(TraversalType::InOrder, 0LL, std::plus<>()), 40000LL * 39999 / 2);
+    EXPECT_TRUE(tree.parallel_reduce(TraversalType::InOrder, true, std::logical_and<>(), [](int value) { return value >= 0; }, 4));
+    EXPECT_FALSE(tree.parallel_reduce(TraversalType::PostOrder, false, std::logical_or<>(), [](int value) { return value > 40000; }, 4));
+
+    std::vector<std::vector<int>> chunks = tree.parallel_for_each_chunk(TraversalType::PostOrder, [](auto first, auto last) {
+        std::vector<int> values;
+        for (; first != last; ++first) {
+            values.push_back(*first);
+        }
+        return values;
+    }, 4);
+    std::vector<int> post;
+    for (auto i = tree.begin(TraversalType::PostOrder); i != tree.end(TraversalType::PostOrder); ++i) {
+        post.push_back(*i);
+    }
+    std::vector<int> joined;
+    for (const std::vector<int>& chunk : chunks) {
+        joined.insert(joined.end(), chunk.begin(), chunk.end());
+    }
+    EXPECT_GT(chunks.size(), 1);
+    EXPECT_EQ(joined, post);
+
+    EXPECT_THROW(tree.parallel_for_each(TraversalType::InOrder, [](int value) {
+        if (value == 777) {
+            throw std::out_of_range("777");
+        }
+    }, 4), std::out_of_range);
+    EXPECT_EQ(tree.parallel_reduce(TraversalType::InOrder, 0LL, std::plus<>(), [&tree](int value) {
+        return value % 10000 == 0 ? tree.parallel_reduce(TraversalType::PreOrder, 0LL, std::plus<>(), std::identity(), 4) : 0LL;
+    }, 4), 4 * (40000LL * 39999 / 2));
+}
+
+TEST(BinarySearchTreeTest, StaticTreeIsBuiltAtCompileTime) {
+    static constexpr static_bst opcodes({7, 3, 11, 3, 1, 42, 5});
+    static_assert(opcodes.size() == 6);
+    static_assert(opcodes.contains(42));
+    static_assert(!opcodes.contains(4));
+    static_assert(*opcodes.lower_bound(4) == 5);
+
+    std::vector<int> sorted = {1, 3, 5, 7, 11, 42};
+    EXPECT_EQ(std::vector<int>(opcodes.begin(), opcodes.end()), sorted);
+    EXPECT_EQ(*opcodes.rbegin(), 42);
+    EXPECT_EQ(*opcodes.find(11), 11);
+    EXPECT_EQ(opcodes.find(12), opcodes.end());
+    EXPECT_EQ(*opcodes.upper_bound(11), 42);
+    EXPECT_EQ(opcodes.lower_bound(43), opcodes.end());
+}